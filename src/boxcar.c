@@ -0,0 +1,403 @@
+// Copyright (c) 2026 Bence Göblyös
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "pico/stdlib.h"
+#include "hardware/pio.h"
+#include "hardware/dma.h"
+#include "hardware/adc.h"
+#include "pico-pulse.pio.h"
+
+#include "boxcar.h"
+#include "counter.h"
+#include "hardware.h"
+
+// The ADC is free-running and its samples are moved into a ring by DMA
+#define BOX_RING_BITS 14
+#define BOX_RING_LEN ((1 << BOX_RING_BITS) / sizeof(uint16_t))
+uint16_t box_ring[BOX_RING_LEN] __aligned(1 << BOX_RING_BITS);
+
+// Edges of the windows, recorded as the remaining transfer count of the ADC DMA,
+// along with the edge numbers pushed by the PIO, which show if edges were lost
+#define BOX_TAG_BITS 10
+#define BOX_TAG_LEN ((1 << BOX_TAG_BITS) / sizeof(uint32_t))
+uint32_t box_tags[BOX_TAG_LEN] __aligned(1 << BOX_TAG_BITS);
+uint32_t box_edge_nums[BOX_TAG_LEN] __aligned(1 << BOX_TAG_BITS);
+
+// Max number of windows in a sequence
+#define BOX_MAX_WINDOWS 256
+
+// Max number of samples summed in a single call of boxcar_task
+#define BOX_TASK_BUDGET 1024
+
+// Pull in PIO related constants from main.c
+extern const uint pio_base_gpio;
+extern const uint pio_n_gpio;
+
+// Pull in channel groups from hardware.c
+extern pulse_group_t groups[];
+
+// Window edge detector PIO variables
+PIO box_pio;
+uint box_sm;
+uint box_offset;
+
+// DMA channels: ADC samples, PIO edge numbers and edge timestamps
+ring_dma_t box_adc = {.dma = -1, .reload = -1};
+int box_pace_dma = -1;
+int box_tag_dma = -1;
+dma_channel_config box_pace_conf;
+dma_channel_config box_tag_conf;
+
+// Per window accumulators
+uint64_t box_sum[BOX_MAX_WINDOWS];
+uint64_t box_count[BOX_MAX_WINDOWS];
+
+// Boxcar state
+bool box_enabled = false;
+uint box_window_ch;
+uint box_adc_input;
+uint32_t box_windows = 0;       // Number of windows in a single copy of the sequence
+uint32_t box_tags_consumed = 0; // Ring position of the next unprocessed edge
+uint32_t box_edges = 0;         // Number of the next unprocessed edge
+uint32_t box_window = 0;        // Index of the window being summed
+bool box_in_window = false;     // Set while a window is partially summed
+uint32_t box_pos;               // Next sample of the window being summed
+uint32_t box_end;               // One past the last sample of the window being summed
+uint64_t box_total = 0;         // Number of windows accumulated since the last clear
+bool box_overrun = false;       // Set if samples were overwritten before they were summed
+
+// The PIO counts down from 0
+static inline uint32_t box_edge_num(uint32_t i) {
+	return 0u - box_edge_nums[i];
+}
+
+void start_box_tag_dma() {
+	box_tags_consumed = 0;
+	box_edges = 0;
+	dma_channel_configure(
+		box_tag_dma,
+		&box_tag_conf,
+		box_tags,
+		&dma_hw->ch[box_adc.dma].transfer_count,
+		1,
+		false
+	);
+	dma_channel_configure(
+		box_pace_dma,
+		&box_pace_conf,
+		box_edge_nums,
+		&box_pio->rxf[box_sm],
+		1,
+		true
+	);
+}
+
+// Stop the edge recording and the sampling
+void stop_box_dma() {
+	// Break the chain before aborting, so the channels don't re-trigger each other
+	channel_config_set_chain_to(&box_pace_conf, box_pace_dma);
+	dma_channel_set_config(box_pace_dma, &box_pace_conf, false);
+	dma_channel_abort(box_pace_dma);
+	dma_channel_abort(box_tag_dma);
+	channel_config_set_chain_to(&box_pace_conf, box_tag_dma);
+	ring_dma_stop(&box_adc);
+}
+
+bool enable_boxcar(uint window_ch, uint adc_input) {
+	if (box_enabled)
+		disable_boxcar();
+
+	uint window_pin = pio_base_gpio + window_ch;
+
+	// Find a free pio and state machine that can access the window pin and add the program
+	if (!pio_claim_free_sm_and_add_program_for_gpio_range(
+		&edge_tag_program,
+		&box_pio,
+		&box_sm,
+		&box_offset,
+		window_pin,
+		1,
+		true
+	))
+		return false;
+
+	edge_tag_program_init(box_pio, box_sm, box_offset, window_pin);
+
+	// Set up ADC in free-running mode, with each sample going to the FIFO
+	adc_init();
+	adc_gpio_init(26 + adc_input);
+	adc_select_input(adc_input);
+	adc_fifo_setup(true, true, 1, false, false);
+	// Sample as fast as possible (500 ksps)
+	adc_set_clkdiv(0);
+
+	// ADC FIFO to sample ring
+	ring_dma_init(&box_adc, box_ring, BOX_RING_BITS, DMA_SIZE_16, &adc_hw->fifo, DREQ_ADC);
+	box_pace_dma = dma_claim_unused_channel(true);
+	box_tag_dma = dma_claim_unused_channel(true);
+
+	// PIO edge requests, each one moves the edge number into its ring and triggers the tag channel
+	box_pace_conf = dma_channel_get_default_config(box_pace_dma);
+	channel_config_set_transfer_data_size(&box_pace_conf, DMA_SIZE_32);
+	channel_config_set_read_increment(&box_pace_conf, false);
+	channel_config_set_write_increment(&box_pace_conf, true);
+	channel_config_set_ring(&box_pace_conf, true, BOX_TAG_BITS);
+	channel_config_set_dreq(&box_pace_conf, pio_get_dreq(box_pio, box_sm, false));
+	channel_config_set_chain_to(&box_pace_conf, box_tag_dma);
+
+	// Copies the position of the ADC DMA into the tag ring, then re-arms the pacing channel
+	box_tag_conf = dma_channel_get_default_config(box_tag_dma);
+	channel_config_set_transfer_data_size(&box_tag_conf, DMA_SIZE_32);
+	channel_config_set_read_increment(&box_tag_conf, false);
+	channel_config_set_write_increment(&box_tag_conf, true);
+	channel_config_set_ring(&box_tag_conf, true, BOX_TAG_BITS);
+	channel_config_set_chain_to(&box_tag_conf, box_pace_dma);
+
+	box_window_ch = window_ch;
+	box_adc_input = adc_input;
+	box_enabled = true;
+
+	clear_boxcar();
+	return true;
+}
+
+void disable_boxcar() {
+	if (!box_enabled)
+		return;
+
+	adc_run(false);
+	pio_sm_set_enabled(box_pio, box_sm, false);
+	stop_box_dma();
+	adc_fifo_drain();
+
+	ring_dma_release(&box_adc);
+	dma_channel_unclaim(box_pace_dma);
+	dma_channel_unclaim(box_tag_dma);
+	pio_remove_program_and_unclaim_sm(&edge_tag_program, box_pio, box_sm, box_offset);
+
+	box_pace_dma = -1;
+	box_tag_dma = -1;
+	box_enabled = false;
+}
+
+// Bit of the window channel in the buffer words of group g, or 0 if the boxcar doesn't follow g
+uint32_t boxcar_window_mask(pulse_group_t* g) {
+	if (!box_enabled || &groups[group_of_channel(box_window_ch)] != g)
+		return 0;
+	return 1u << (box_window_ch - g->first_ch);
+}
+
+// Clear the accumulators after the sequence of group g changed, if the windows come from g.
+// Other groups don't move the windows, so summing carries on. g should be stopped.
+void clear_boxcar_group(pulse_group_t* g) {
+	if (boxcar_window_mask(g))
+		clear_boxcar();
+}
+
+// Reset the accumulators and restart from the first window of the sequence.
+// Should be called while the output is stopped, otherwise the first window might be partial.
+void clear_boxcar() {
+	if (!box_enabled)
+		return;
+
+	// With too many windows the accumulators would alias, so nothing is summed until the sequence changes
+	box_windows = count_gates(box_window_ch);
+
+	memset(box_sum, 0, sizeof(box_sum));
+	memset(box_count, 0, sizeof(box_count));
+	box_window = 0;
+	box_in_window = false;
+	box_total = 0;
+	box_overrun = false;
+
+	// Stop everything
+	adc_run(false);
+	pio_sm_set_enabled(box_pio, box_sm, false);
+	stop_box_dma();
+
+	// Restart the edge detector from the top of the program with an empty FIFO, numbering edges from 0
+	pio_sm_clear_fifos(box_pio, box_sm);
+	pio_sm_restart(box_pio, box_sm);
+	pio_sm_exec(box_pio, box_sm, pio_encode_set(pio_x, 0));
+	pio_sm_exec(box_pio, box_sm, pio_encode_jmp(box_offset));
+
+	// Restart the sampling
+	adc_fifo_drain();
+	ring_dma_start(&box_adc);
+	start_box_tag_dma();
+	pio_sm_set_enabled(box_pio, box_sm, true);
+	adc_run(true);
+}
+
+// Called from the main loop, sums the samples of finished windows into their accumulators.
+// Only a limited number of samples are processed at once to keep the DMA restarts in the main loop timely.
+void boxcar_task() {
+	if (!box_enabled || box_windows == 0 || box_windows > BOX_MAX_WINDOWS)
+		return;
+
+	uint32_t budget = BOX_TASK_BUDGET;
+	uint32_t adc_pos = ring_dma_pos(&box_adc);
+	// The tag channel only does a single transfer each time it's triggered, so use its ring position
+	uint32_t tags_received = (dma_hw->ch[box_tag_dma].write_addr - (uintptr_t)box_tags) / sizeof(box_tags[0]);
+
+	while (budget != 0) {
+		if (!box_in_window) {
+			uint32_t available = (tags_received - box_tags_consumed) % BOX_TAG_LEN;
+
+			// After losing edges, skip the rest of the window that was open
+			if (box_edges % 2 == 1) {
+				if (available == 0)
+					break;
+				box_tags_consumed = (box_tags_consumed + 1) % BOX_TAG_LEN;
+				box_edges++;
+				continue;
+			}
+
+			// Wait for both edges of the next window
+			if (available < 2)
+				break;
+
+			uint32_t rise = box_tags[box_tags_consumed];
+			uint32_t fall = box_tags[(box_tags_consumed + 1) % BOX_TAG_LEN];
+
+			// The edge numbers are written before the tags, so they're checked after reading the tags.
+			// If they don't match, the tag ring was lapped or the PIO FIFO was full. Continue from the newest edge.
+			if (box_edge_num(box_tags_consumed) != box_edges || box_edge_num((box_tags_consumed + 1) % BOX_TAG_LEN) != box_edges + 1) {
+				box_overrun = true;
+				box_edges = box_edge_num((tags_received + BOX_TAG_LEN - 1) % BOX_TAG_LEN) + 1;
+				box_tags_consumed = tags_received;
+				continue;
+			}
+
+			box_pos = ring_dma_count_to_pos(rise);
+			box_end = ring_dma_count_to_pos(fall);
+			box_window = (box_edges / 2) % box_windows;
+			box_tags_consumed = (box_tags_consumed + 2) % BOX_TAG_LEN;
+			box_edges += 2;
+			box_in_window = true;
+		}
+
+		// Samples older than a ring length have already been overwritten
+		if (((adc_pos - box_pos) & (RING_DMA_LEN - 1)) > BOX_RING_LEN) {
+			box_overrun = true;
+			box_in_window = false;
+			continue;
+		}
+
+		while (budget != 0 && box_pos != box_end) {
+			box_sum[box_window] += box_ring[box_pos % BOX_RING_LEN];
+			box_count[box_window]++;
+			box_pos = (box_pos + 1) & (RING_DMA_LEN - 1);
+			budget--;
+		}
+
+		if (box_pos == box_end) {
+			box_in_window = false;
+			box_total++;
+		}
+	}
+}
+
+void set_boxcar_cmd(char* next_token) {
+	char* tmp;
+	uint window_ch;
+	uint adc_input;
+
+	tmp = strtok_r(NULL, " ", &next_token);
+	if (!tmp) {
+		printf("Error: window channel could not be parsed.\n");
+		return;
+	}
+
+	if (!strcmp(tmp, "OFF")) {
+		disable_boxcar();
+		printf("ACK\n");
+		return;
+	}
+
+	window_ch = strtoul(tmp, NULL, 10);
+	if (window_ch >= pio_n_gpio) {
+		printf("Error: window channel is invalid!\n");
+		return;
+	}
+
+	tmp = strtok_r(NULL, " ", &next_token);
+	if (!tmp) {
+		printf("Error: ADC input could not be parsed.\n");
+		return;
+	}
+
+	adc_input = strtoul(tmp, NULL, 10);
+	if (adc_input >= 4) {
+		printf("Error: ADC input is invalid!\n");
+		return;
+	}
+
+	if (!enable_boxcar(window_ch, adc_input)) {
+		printf("Error: no free state machine for the boxcar.\n");
+		return;
+	}
+
+	if (box_windows > BOX_MAX_WINDOWS) {
+		printf("Error: sequence has %lu windows, at most %d are supported!\n", box_windows, BOX_MAX_WINDOWS);
+		disable_boxcar();
+		return;
+	}
+
+	printf("OK, windows = %lu\n", box_windows);
+}
+
+void get_boxcar_cmd() {
+	printf("%d,%lu,%llu,%d\n", box_enabled ? 1 : 0, box_windows, box_total, box_overrun ? 1 : 0);
+}
+
+// Print mean, sum and sample count of each window as comma separated values,
+// optionally only for a range of windows
+void get_boxcar_data_cmd(char* next_token) {
+	char* tmp;
+	uint32_t start = 0;
+	uint32_t len = box_windows;
+
+	if (box_windows > BOX_MAX_WINDOWS) {
+		printf("Error: sequence has %lu windows, at most %d are supported!\n", box_windows, BOX_MAX_WINDOWS);
+		return;
+	}
+
+	tmp = strtok_r(NULL, " ", &next_token);
+	if (tmp)
+		start = strtoul(tmp, NULL, 10);
+
+	tmp = strtok_r(NULL, " ", &next_token);
+	if (tmp)
+		len = strtoul(tmp, NULL, 10);
+
+	if (start >= box_windows) {
+		printf("\n");
+		return;
+	}
+
+	if (len > box_windows - start)
+		len = box_windows - start;
+
+	for (uint32_t i = start; i < start + len; i++)
+		printf(
+			i + 1 < start + len ? "%.3f,%llu,%llu," : "%.3f,%llu,%llu",
+			box_count[i] != 0 ? (double)box_sum[i] / box_count[i] : 0.0,
+			box_sum[i],
+			box_count[i]
+		);
+	printf("\n");
+}
+
+void clear_boxcar_cmd() {
+	clear_boxcar();
+	if (box_windows > BOX_MAX_WINDOWS) {
+		printf("Error: sequence has %lu windows, at most %d are supported!\n", box_windows, BOX_MAX_WINDOWS);
+		return;
+	}
+	printf("ACK\n");
+}
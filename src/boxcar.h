@@ -0,0 +1,17 @@
+#pragma once
+
+#include "pico/stdlib.h"
+
+#include "hardware.h"
+
+bool enable_boxcar(uint window_ch, uint adc_input);
+void disable_boxcar(void);
+void clear_boxcar(void);
+uint32_t boxcar_window_mask(pulse_group_t* g);
+void clear_boxcar_group(pulse_group_t* g);
+void boxcar_task(void);
+
+void set_boxcar_cmd(char* next_token);
+void get_boxcar_cmd(void);
+void get_boxcar_data_cmd(char* next_token);
+void clear_boxcar_cmd(void);
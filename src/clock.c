@@ -0,0 +1,178 @@
+// Copyright (c) 2026 Bence Göblyös
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "pico/stdlib.h"
+#include "hardware/clocks.h"
+#include "hardware/vreg.h"
+#include "hardware/watchdog.h"
+#include "hardware/sync.h"
+#include "hardware/uart.h"
+#if PICO_RP2350
+#include "hardware/structs/qmi.h"
+#endif
+
+#include "clock.h"
+#include "hardware.h"
+#include "pulse.h"
+#include "rheostat.h"
+#include "counter.h"
+#include "boxcar.h"
+
+// Clock speeds above the compile-time default need a higher core voltage.
+// Only these combinations have been validated, anything else above SYS_CLK_HZ is rejected.
+typedef struct {
+	uint32_t hz;
+	enum vreg_voltage voltage;
+} clock_profile_t;
+
+#define CLOCK_PROFILES_LEN 3
+const clock_profile_t clock_profiles[CLOCK_PROFILES_LEN] = {
+	{250000000, VREG_VOLTAGE_1_15},
+	{300000000, VREG_VOLTAGE_1_20},
+	{400000000, VREG_VOLTAGE_1_30},
+};
+
+// Lowest accepted clock speed. Below this, the main loop can't keep up with restarting the DMA
+// and servicing the counter and boxcar, and the 4 cycle minimum pulse gets needlessly long.
+#define CLOCK_MIN_HZ 50000000
+
+// Highest clock speed of the QSPI flash
+#define FLASH_MAX_HZ 133000000
+
+// Watchdog timeout while switching clocks. If the core locks up, the device reboots
+// and comes back with the compile-time clock settings and default voltage.
+#define CLOCK_WATCHDOG_MS 500
+
+// Pull in CPU clock rate from main.c
+extern uint32_t cpu_clk;
+
+// Pull in channel groups from hardware.c
+extern pulse_group_t groups[];
+extern uint n_groups;
+
+// Current core voltage
+enum vreg_voltage clock_voltage = VREG_VOLTAGE_DEFAULT;
+
+#if PICO_RP2350
+// Set the flash clock divider, so the flash stays within spec at the given system clock.
+// XIP must not be accessed while the timing is changed, so this has to run from RAM.
+void __no_inline_not_in_flash_func(set_flash_divider)(uint32_t hz) {
+	uint32_t div = (hz + FLASH_MAX_HZ - 1) / FLASH_MAX_HZ;
+	div = div < 2 ? 2 : div;
+
+	uint32_t irq = save_and_disable_interrupts();
+	qmi_hw->m[0].timing = (qmi_hw->m[0].timing & ~(QMI_M0_TIMING_CLKDIV_BITS | QMI_M0_TIMING_RXDELAY_BITS))
+		| (div << QMI_M0_TIMING_CLKDIV_LSB)
+		| (div << QMI_M0_TIMING_RXDELAY_LSB);
+	// Read back to make sure the write has gone through before executing from flash again
+	(void)qmi_hw->m[0].timing;
+	restore_interrupts(irq);
+}
+#endif
+
+bool set_clock(uint32_t hz, char* err) {
+	uint vco;
+	uint postdiv1;
+	uint postdiv2;
+	enum vreg_voltage voltage = VREG_VOLTAGE_DEFAULT;
+
+	// 0 restores the compile-time default
+	if (hz == 0)
+		hz = SYS_CLK_HZ;
+
+	if (hz < CLOCK_MIN_HZ) {
+		strcpy(err, "Clock speed is below the minimum of 50 MHz.");
+		return false;
+	}
+
+	if (hz > SYS_CLK_HZ) {
+		bool found = false;
+		for (uint32_t i = 0; i < CLOCK_PROFILES_LEN; i++)
+			if (clock_profiles[i].hz == hz) {
+				voltage = clock_profiles[i].voltage;
+				found = true;
+			}
+
+		if (!found) {
+			strcpy(err, "Clock speed is above the default and not a validated overclock profile.");
+			return false;
+		}
+	}
+
+	if (hz % 1000 != 0 || !check_sys_clock_khz(hz / 1000, &vco, &postdiv1, &postdiv2)) {
+		strcpy(err, "Clock speed can't be generated exactly by the PLL.");
+		return false;
+	}
+
+	// The buffered sequence was encoded for the old clock, so it's thrown away
+	stop_all();
+	for (uint i = 0; i < n_groups; i++)
+		reset_group_sequence(&groups[i]);
+
+	watchdog_enable(CLOCK_WATCHDOG_MS, true);
+
+	// Raise voltage and slow down flash before speeding up
+	if (voltage > clock_voltage) {
+		vreg_set_voltage(voltage);
+		busy_wait_us(1000);
+	}
+#if PICO_RP2350
+	if (hz > cpu_clk)
+		set_flash_divider(hz);
+#endif
+
+	// This temporarily runs clk_sys from the USB PLL, which itself is left alone, so USB stays up
+	set_sys_clock_khz(hz / 1000, true);
+
+	// Speed up flash and lower voltage after slowing down
+#if PICO_RP2350
+	if (hz < cpu_clk)
+		set_flash_divider(hz);
+#endif
+	if (voltage < clock_voltage)
+		vreg_set_voltage(voltage);
+
+	watchdog_disable();
+
+	clock_voltage = voltage;
+	cpu_clk = clock_get_hz(clk_sys);
+
+	// Cached divisors and peripherals clocked from clk_sys need to follow the new clock
+	gcd_clear_cache();
+	setup_i2c();
+	uart_set_baudrate(uart_default, PICO_DEFAULT_UART_BAUD_RATE);
+	clear_counter();
+	clear_boxcar();
+
+	return true;
+}
+
+void set_clock_cmd(char* next_token) {
+	static char err[256];
+	char* tmp;
+	char* end;
+	uint32_t hz;
+
+	tmp = strtok_r(NULL, " ", &next_token);
+	if (!tmp) {
+		printf("Error: clock speed could not be parsed.\n");
+		return;
+	}
+
+	hz = strtoul(tmp, &end, 10);
+	if (end == tmp || *end != '\0') {
+		printf("Error: clock speed could not be parsed.\n");
+		return;
+	}
+
+	if (!set_clock(hz, err)) {
+		printf("Error: %s\n", err);
+		return;
+	}
+
+	printf("OK, clk = %lu\n", cpu_clk);
+}
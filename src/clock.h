@@ -0,0 +1,6 @@
+#pragma once
+
+#include "pico/stdlib.h"
+
+bool set_clock(uint32_t hz, char* err);
+void set_clock_cmd(char* next_token);
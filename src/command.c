@@ -15,47 +15,67 @@
 #include "pulse.h"
 #include "laser.h"
 #include "rheostat.h"
+#include "counter.h"
+#include "boxcar.h"
+#include "clock.h"
+#include "transport.h"
+#include "flashseq.h"
+#include "events.h"
+#include "playlist.h"
 
 // Incoming command buffer
 #define CMD_BUF_LEN 65536
 char cmd_buf[CMD_BUF_LEN]; 
 
+// A transport that stops sending in the middle of a command loses the command buffer after this long
+#define CMD_RX_TIMEOUT_US 1000000
+
 // Buffer for storing board id
 #define BID_BUF_LEN 2 * PICO_UNIQUE_BOARD_ID_SIZE_BYTES + 1
 char bid_buf[BID_BUF_LEN]; 
 
 bool cmd_ready = false;           // Indicate whether command ready to be processed
-bool rx_available = false;        // Indicate whether a character is avaialble on stdin
 
 // Pull in CPU clock rate from main.c
 extern uint32_t cpu_clk;
 
+// Pull in channel groups from hardware.c
+extern pulse_group_t groups[];
+extern uint cur_group;
+
 // Pull in PIO variables from main.c
 extern uint32_t pio_buf[];
 extern const uint32_t pio_buf_len;
 extern const uint32_t pio_extra_cycles;
 extern const uint pio_n_gpio;
 
-// Pull in DMA variables from hardware.c
-extern uint32_t loop;
-extern int dma;
-extern uint dma_count;
-
-// This function is set as the callback when chars are available on stdin
-void rx_handler(void* ptr) {
-	rx_available = true;
-}
 
 // This function is called in the main loop every time there's a character available
 void cmd_read_char() {
-	static uint32_t rx_counter = 0;  // Keep track of cursor position in receive buffer
-	static int rx_tmp;               // Temporary buffer for received character
+	static uint32_t rx_counter = 0;       // Keep track of cursor position in receive buffer
+	static int rx_tmp;                    // Temporary buffer for received character
+	static transport_t* rx_source = NULL; // Transport the command in the buffer is coming from
+	static uint64_t rx_last_us = 0;       // Time the last character of a partial command was received
+
+	// A transport owns the command buffer from the first character of a line until its end,
+	// so commands arriving on different transports at the same time don't get interleaved
+	if (rx_source == NULL) {
+		rx_source = next_transport();
+		if (rx_source == NULL)
+			return;
+	}
 
     // Read in single char
-    rx_tmp = stdio_getchar_timeout_us(0);
+    rx_tmp = rx_source->read_char();
 
+	// If characters were lost, the command in the buffer is incomplete
+	if (rx_tmp == PICO_ERROR_IO) {
+		printf("Error: %s receive buffer overrun, command discarded!\n", rx_source->name);
+		rx_counter = 0;
+		rx_source = NULL;
+	}
 	// If the new character is received successfully, process it
-	if (rx_tmp != PICO_ERROR_TIMEOUT) {
+	else if (rx_tmp != PICO_ERROR_NO_DATA) {
     	// If character is LF or CR or we ran out of space, terminate string and hand off
     	// into another buffer for further processing. The non-zero length check prevents
     	// extra line terminations, so CRLF doesn't result in a new zero-length string
@@ -68,18 +88,26 @@ void cmd_read_char() {
 			//printf("Command read-in successful: %s.\n", cmd_buf);
 			// Indicate that command is ready for processing
     		cmd_ready = true;
-			// Reset counter
+			// Reset counter and release the buffer
 			rx_counter = 0;
+			rx_source = NULL;
     	}
     	// If the received character is printable, convert it to uppercase and append to command buffer
     	else if (isprint(rx_tmp)) {
         	cmd_buf[rx_counter++] = toupper((char)rx_tmp);
+			rx_last_us = time_us_64();
 			//printf("Read in character %c.\n", (char)rx_tmp);
     	}
 	}
-	else {
-		// If we couldn't get a character, indicate that the buffer is empty
-		rx_available = false;
+	else if (rx_counter == 0) {
+		// If the transport ran dry between commands, let the others have a go
+		rx_source = NULL;
+	}
+	else if (time_us_64() - rx_last_us > CMD_RX_TIMEOUT_US) {
+		// A partial command that stopped arriving (e.g. USB was unplugged mid-line) would lock out the other transports
+		printf("Error: incomplete command on %s timed out, command discarded!\n", rx_source->name);
+		rx_counter = 0;
+		rx_source = NULL;
 	}
 }
 
@@ -96,6 +124,8 @@ void cmd_decode() {
 		print_id();
 	} else if (!strcmp(cmd_word, "CLK?")) {
 		print_clk();
+	} else if (!strcmp(cmd_word, "CLK")) {
+		set_clock_cmd(next_token);
 	} else if (!strcmp(cmd_word, "BUFFER?")) {
 		print_buf();
 	} else if (!strcmp(cmd_word, "MAXT?")) {
@@ -109,6 +139,58 @@ void cmd_decode() {
 		decode_sequence(next_token, false);
 	} else if (!strcmp(cmd_word, "CPULSE")) {
 		decode_sequence(next_token, true);
+	} else if (!strcmp(cmd_word, "OPTIMIZE")) {
+		set_optimize_cmd(next_token);
+	} else if (!strcmp(cmd_word, "OPTIMIZE?")) {
+		get_optimize_cmd();
+	} else if (!strcmp(cmd_word, "PULSE:CHECK")) {
+		check_sequence(next_token, false);
+	} else if (!strcmp(cmd_word, "CPULSE:CHECK")) {
+		check_sequence(next_token, true);
+	} else if (!strcmp(cmd_word, "EDGES")) {
+		decode_edges(next_token, false);
+	} else if (!strcmp(cmd_word, "CEDGES")) {
+		decode_edges(next_token, true);
+	} else if (!strcmp(cmd_word, "PATCH")) {
+		patch_sequence(next_token, false);
+	} else if (!strcmp(cmd_word, "CPATCH")) {
+		patch_sequence(next_token, true);
+	} else if (!strcmp(cmd_word, "FLASH:BEGIN")) {
+		flash_begin_cmd();
+	} else if (!strcmp(cmd_word, "FLASH:APPEND")) {
+		flash_append_cmd(next_token, false);
+	} else if (!strcmp(cmd_word, "FLASH:CAPPEND")) {
+		flash_append_cmd(next_token, true);
+	} else if (!strcmp(cmd_word, "FLASH:END")) {
+		flash_end_cmd();
+	} else if (!strcmp(cmd_word, "FLASH:RUN")) {
+		flash_run_cmd(next_token);
+	} else if (!strcmp(cmd_word, "FLASH?")) {
+		get_flash_cmd();
+	} else if (!strcmp(cmd_word, "EVENTS")) {
+		set_events_cmd(next_token);
+	} else if (!strcmp(cmd_word, "EVENTS?")) {
+		get_events_cmd();
+	} else if (!strcmp(cmd_word, "LOOPBACK")) {
+		loopback_cmd(next_token);
+	} else if (!strcmp(cmd_word, "PLAYLIST")) {
+		set_playlist_cmd(next_token);
+	} else if (!strcmp(cmd_word, "PLAYLIST?")) {
+		get_playlist_cmd();
+	} else if (!strcmp(cmd_word, "GROUPS")) {
+		set_groups_cmd(next_token);
+	} else if (!strcmp(cmd_word, "GROUPS?")) {
+		get_groups_cmd();
+	} else if (!strcmp(cmd_word, "GROUP")) {
+		set_group_cmd(next_token);
+	} else if (!strcmp(cmd_word, "GROUP?")) {
+		get_group_cmd();
+	} else if (!strcmp(cmd_word, "SYNC")) {
+		set_sync_cmd(next_token);
+	} else if (!strcmp(cmd_word, "SYNC?")) {
+		get_sync_cmd();
+	} else if (!strcmp(cmd_word, "START")) {
+		start_cmd();
 	} else if (!strcmp(cmd_word, "LASER")) {
 		set_laser_state_cmd(next_token);
 	} else if (!strcmp(cmd_word, "LASER?")) {
@@ -125,6 +207,22 @@ void cmd_decode() {
 		set_current_limit_cmd(next_token);
 	} else if (!strcmp(cmd_word, "LIM?") || !strcmp(cmd_word, "LIMIT?")) {
 		get_current_limit_cmd();
+	} else if (!strcmp(cmd_word, "COUNTER")) {
+		set_counter_cmd(next_token);
+	} else if (!strcmp(cmd_word, "COUNTER?")) {
+		get_counter_cmd();
+	} else if (!strcmp(cmd_word, "COUNTS?")) {
+		get_counts_cmd(next_token);
+	} else if (!strcmp(cmd_word, "COUNTCLR")) {
+		clear_counter_cmd();
+	} else if (!strcmp(cmd_word, "BOXCAR")) {
+		set_boxcar_cmd(next_token);
+	} else if (!strcmp(cmd_word, "BOXCAR?")) {
+		get_boxcar_cmd();
+	} else if (!strcmp(cmd_word, "BOXDATA?")) {
+		get_boxcar_data_cmd(next_token);
+	} else if (!strcmp(cmd_word, "BOXCLR")) {
+		clear_boxcar_cmd();
 	}
 	else {
 		printf("Error: command not recognized.\n");
@@ -150,7 +248,7 @@ void print_id() {
 
 void print_clk() { printf("%lu\n", cpu_clk); }
 
-void print_buf() { printf("%lu\n", pio_buf_len); }
+void print_buf() { printf("%lu\n", groups[cur_group].buf_len); }
 
 void print_maxt() {
 	// Conversion factor from seconds to nanoseconds
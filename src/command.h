@@ -1,6 +1,5 @@
 #pragma once
 
-void rx_handler(void* ptr);
 void cmd_read_char(void);
 void cmd_decode(void);
 void print_id(void);
@@ -0,0 +1,293 @@
+// Copyright (c) 2026 Bence Göblyös
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "pico/stdlib.h"
+#include "hardware/pio.h"
+#include "hardware/dma.h"
+#include "pico-pulse.pio.h"
+
+#include "counter.h"
+#include "hardware.h"
+
+// Ring buffer for the per-gate counts coming from the PIO
+#define COUNT_RING_BITS 12
+#define COUNT_RING_LEN ((1 << COUNT_RING_BITS) / sizeof(uint32_t))
+uint32_t count_ring[COUNT_RING_LEN] __aligned(1 << COUNT_RING_BITS);
+
+// Max number of gates in a sequence, each one gets its own histogram bin
+#define COUNT_MAX_BINS 1024
+uint64_t count_hist[COUNT_MAX_BINS];
+
+// Max number of gates processed in a single call of counter_task
+#define COUNT_TASK_BUDGET 64
+
+// Pull in PIO related constants from main.c
+extern const uint pio_base_gpio;
+extern const uint pio_n_gpio;
+
+// Pull in the boxcar's ADC input from boxcar.c
+extern bool box_enabled;
+extern uint box_adc_input;
+
+// Pull in channel groups from hardware.c
+extern pulse_group_t groups[];
+
+// Counter PIO variables
+PIO count_pio;
+uint count_sm;
+uint count_offset;
+
+// Counter DMA
+ring_dma_t count_rx = {.dma = -1, .reload = -1};
+
+// Counter state
+bool count_enabled = false;
+uint count_in_pin;
+uint count_gate_ch;
+uint32_t count_bins = 0;       // Number of gates in a single copy of the sequence, counting is suspended above COUNT_MAX_BINS
+uint32_t count_consumed = 0;   // DMA position of the next gate to be taken out of the ring
+uint32_t count_gate = 0;       // Bin of the next gate
+uint64_t count_total = 0;      // Number of gates accumulated since the last clear
+bool count_overrun = false;    // Set if gates were lost because the ring filled up
+
+// Count the gates (rising edges of the gate channel) in a single copy of the sequence of its group.
+// The sequence is treated as cyclic, so a gate spanning the end and start is only counted once.
+// A gate is only pushed by the PIO when it closes, and the output holds the mask of the last word
+// after a run, so if the sequence ends with the gate high, the last gate of the run stays open.
+uint32_t count_gates(uint gate_ch) {
+	pulse_group_t* g = &groups[group_of_channel(gate_ch)];
+	uint bit = gate_ch - g->first_ch;
+	uint32_t gates = 0;
+	bool prev;
+	bool cur;
+
+	if (g->seq_len == 0)
+		return 0;
+
+	prev = (g->buf[g->seq_len - 1] >> bit) & 1;
+	for (uint32_t i = 0; i < g->seq_len; i++) {
+		cur = (g->buf[i] >> bit) & 1;
+		if (cur && !prev)
+			gates++;
+		prev = cur;
+	}
+
+	return gates;
+}
+
+bool enable_counter(uint in_pin, uint gate_ch) {
+	if (count_enabled)
+		disable_counter();
+
+	uint gate_pin = pio_base_gpio + gate_ch;
+	uint lo = in_pin < gate_pin ? in_pin : gate_pin;
+	uint hi = in_pin < gate_pin ? gate_pin : in_pin;
+
+	// Find a free pio and state machine that can access both pins and add the program
+	if (!pio_claim_free_sm_and_add_program_for_gpio_range(
+		&gate_count_program,
+		&count_pio,
+		&count_sm,
+		&count_offset,
+		lo,
+		hi - lo + 1,
+		true
+	))
+		return false;
+
+	gate_count_program_init(count_pio, count_sm, count_offset, in_pin, gate_pin);
+
+	// Move the counts from the Rx FIFO into the ring
+	ring_dma_init(&count_rx, count_ring, COUNT_RING_BITS, DMA_SIZE_32, &count_pio->rxf[count_sm], pio_get_dreq(count_pio, count_sm, false));
+
+	count_in_pin = in_pin;
+	count_gate_ch = gate_ch;
+	count_enabled = true;
+
+	clear_counter();
+	return true;
+}
+
+void disable_counter() {
+	if (!count_enabled)
+		return;
+
+	pio_sm_set_enabled(count_pio, count_sm, false);
+	ring_dma_release(&count_rx);
+	pio_remove_program_and_unclaim_sm(&gate_count_program, count_pio, count_sm, count_offset);
+	// Give the input pin back, so it can be used again
+	gpio_deinit(count_in_pin);
+
+	count_enabled = false;
+}
+
+// Bit of the gate channel in the buffer words of group g, or 0 if the counter doesn't follow g
+uint32_t counter_gate_mask(pulse_group_t* g) {
+	if (!count_enabled || &groups[group_of_channel(count_gate_ch)] != g)
+		return 0;
+	return 1u << (count_gate_ch - g->first_ch);
+}
+
+// Clear the histogram after the sequence of group g changed, if the gates come from g.
+// Other groups don't move the gates, so counting carries on. g should be stopped.
+void clear_counter_group(pulse_group_t* g) {
+	if (counter_gate_mask(g))
+		clear_counter();
+}
+
+// Reset the histogram and restart counting from the first gate of the sequence.
+// Should be called while the output is stopped, otherwise the first gate might be partial.
+void clear_counter() {
+	if (!count_enabled)
+		return;
+
+	// With too many gates the bins would alias, so nothing is counted until the sequence changes
+	count_bins = count_gates(count_gate_ch);
+
+	memset(count_hist, 0, sizeof(count_hist));
+	count_gate = 0;
+	count_total = 0;
+	count_overrun = false;
+
+	// Restart the state machine from the top of the program with an empty FIFO
+	pio_sm_set_enabled(count_pio, count_sm, false);
+	ring_dma_stop(&count_rx);
+	pio_sm_clear_fifos(count_pio, count_sm);
+	pio_sm_restart(count_pio, count_sm);
+	pio_sm_exec(count_pio, count_sm, pio_encode_jmp(count_offset));
+	count_consumed = 0;
+	ring_dma_start(&count_rx);
+	pio_sm_set_enabled(count_pio, count_sm, true);
+}
+
+// Called from the main loop, moves finished gates from the ring into the histogram.
+// Only a limited number of gates are processed at once to keep the DMA restarts in the main loop timely.
+void counter_task() {
+	if (!count_enabled || count_bins == 0 || count_bins > COUNT_MAX_BINS)
+		return;
+
+	uint32_t received = ring_dma_pos(&count_rx);
+	uint32_t available = (received - count_consumed) & (RING_DMA_LEN - 1);
+
+	// If the ring has been lapped, the oldest gates are lost
+	if (available > COUNT_RING_LEN) {
+		count_overrun = true;
+		count_gate = (count_gate + (available - COUNT_RING_LEN)) % count_bins;
+		count_consumed = (received - COUNT_RING_LEN) & (RING_DMA_LEN - 1);
+		available = COUNT_RING_LEN;
+	}
+
+	for (uint32_t j = 0; j < COUNT_TASK_BUDGET && j < available; j++) {
+		count_hist[count_gate] += count_ring[count_consumed % COUNT_RING_LEN];
+		count_consumed = (count_consumed + 1) & (RING_DMA_LEN - 1);
+		count_total++;
+		if (++count_gate == count_bins)
+			count_gate = 0;
+	}
+}
+
+void set_counter_cmd(char* next_token) {
+	char* tmp;
+	uint in_pin;
+	uint gate_ch;
+
+	tmp = strtok_r(NULL, " ", &next_token);
+	if (!tmp) {
+		printf("Error: input pin could not be parsed.\n");
+		return;
+	}
+
+	if (!strcmp(tmp, "OFF")) {
+		disable_counter();
+		printf("ACK\n");
+		return;
+	}
+
+	in_pin = strtoul(tmp, NULL, 10);
+	if (in_pin >= 30 || (in_pin >= pio_base_gpio && in_pin < pio_base_gpio + pio_n_gpio)) {
+		printf("Error: input pin is invalid!\n");
+		return;
+	}
+
+	// Pins set up for anything else (UART, I2C to the rheostats, laser driver, LED) are in use.
+	// The ADC input of the boxcar doesn't have a function of its own, so it's checked separately.
+	bool own_pin = count_enabled && in_pin == count_in_pin;
+	if ((gpio_get_function(in_pin) != GPIO_FUNC_NULL && !own_pin) || (box_enabled && in_pin == 26 + box_adc_input)) {
+		printf("Error: input pin is already in use!\n");
+		return;
+	}
+
+	tmp = strtok_r(NULL, " ", &next_token);
+	if (!tmp) {
+		printf("Error: gate channel could not be parsed.\n");
+		return;
+	}
+
+	gate_ch = strtoul(tmp, NULL, 10);
+	if (gate_ch >= pio_n_gpio) {
+		printf("Error: gate channel is invalid!\n");
+		return;
+	}
+
+	if (!enable_counter(in_pin, gate_ch)) {
+		printf("Error: no free state machine for the counter.\n");
+		return;
+	}
+
+	if (count_bins > COUNT_MAX_BINS) {
+		printf("Error: sequence has %lu gates, at most %d are supported!\n", count_bins, COUNT_MAX_BINS);
+		disable_counter();
+		return;
+	}
+
+	printf("OK, bins = %lu\n", count_bins);
+}
+
+void get_counter_cmd() {
+	printf("%d,%lu,%llu,%d\n", count_enabled ? 1 : 0, count_bins, count_total, count_overrun ? 1 : 0);
+}
+
+// Print the histogram as comma separated values, optionally only a range of bins
+void get_counts_cmd(char* next_token) {
+	char* tmp;
+	uint32_t start = 0;
+	uint32_t len = count_bins;
+
+	if (count_bins > COUNT_MAX_BINS) {
+		printf("Error: sequence has %lu gates, at most %d are supported!\n", count_bins, COUNT_MAX_BINS);
+		return;
+	}
+
+	tmp = strtok_r(NULL, " ", &next_token);
+	if (tmp)
+		start = strtoul(tmp, NULL, 10);
+
+	tmp = strtok_r(NULL, " ", &next_token);
+	if (tmp)
+		len = strtoul(tmp, NULL, 10);
+
+	if (start >= count_bins) {
+		printf("\n");
+		return;
+	}
+
+	if (len > count_bins - start)
+		len = count_bins - start;
+
+	for (uint32_t i = start; i < start + len; i++)
+		printf(i + 1 < start + len ? "%llu," : "%llu", count_hist[i]);
+	printf("\n");
+}
+
+void clear_counter_cmd() {
+	clear_counter();
+	if (count_bins > COUNT_MAX_BINS) {
+		printf("Error: sequence has %lu gates, at most %d are supported!\n", count_bins, COUNT_MAX_BINS);
+		return;
+	}
+	printf("ACK\n");
+}
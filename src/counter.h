@@ -0,0 +1,18 @@
+#pragma once
+
+#include "pico/stdlib.h"
+
+#include "hardware.h"
+
+bool enable_counter(uint in_pin, uint gate_ch);
+void disable_counter(void);
+void clear_counter(void);
+uint32_t counter_gate_mask(pulse_group_t* g);
+void clear_counter_group(pulse_group_t* g);
+void counter_task(void);
+uint32_t count_gates(uint gate_ch);
+
+void set_counter_cmd(char* next_token);
+void get_counter_cmd(void);
+void get_counts_cmd(char* next_token);
+void clear_counter_cmd(void);
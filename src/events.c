@@ -0,0 +1,217 @@
+// Copyright (c) 2026 Bence Göblyös
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "pico/stdlib.h"
+#include "hardware/dma.h"
+#include "hardware/irq.h"
+#include "hardware/sync.h"
+#if PICO_RP2350
+#include "hardware/structs/m33.h"
+#endif
+
+#include "events.h"
+#include "hardware.h"
+
+// Pull in CPU clock rate from main.c
+extern uint32_t cpu_clk;
+
+// Pull in channel groups from hardware.c
+extern pulse_group_t groups[];
+extern uint n_groups;
+
+// Pull in overrun flags from counter.c and boxcar.c
+extern bool count_overrun;
+extern bool box_overrun;
+
+// Events are queued by the DMA completion interrupt of the output channels and printed
+// by the main loop, at most one every EVENT_MIN_INTERVAL_US, so they can't hold up the DMA restarts.
+#define EVENT_QUEUE_LEN 64
+#define EVENT_MIN_INTERVAL_US 1000
+
+typedef enum {
+	EVENT_DONE,          // A finite run has finished, value is the number of repetitions
+	EVENT_PASS,          // Milestone of a run, value is the number of repetitions so far
+	EVENT_COUNTER,       // Photon counter ring overrun
+	EVENT_BOXCAR,        // Boxcar ring overrun
+} event_type_t;
+
+typedef struct {
+	event_type_t type;
+	uint group;
+	uint32_t value;
+	uint64_t cycles;     // Cycle counter at the time of the event
+} event_t;
+
+bool events_enabled = false;
+uint32_t events_every = 0;           // Report every k-th repetition, 0 disables milestones
+bool events_irq_added = false;
+
+event_t event_queue[EVENT_QUEUE_LEN];
+volatile uint32_t event_wr = 0;      // Only advanced with interrupts disabled or from the interrupt
+volatile uint32_t event_rd = 0;
+uint32_t events_lost = 0;            // Events dropped because the queue was full
+uint32_t event_last_us = 0;
+
+bool count_overrun_prev = false;
+bool box_overrun_prev = false;
+
+// The 32 bit cycle counter wraps every ~20 s, it's extended to 64 bits every time it's read.
+// Must be called with interrupts disabled or from the interrupt.
+uint32_t cycles_last = 0;
+uint64_t cycles_high = 0;
+
+uint64_t read_cycles() {
+#if PICO_RP2350
+	uint32_t now = m33_hw->dwt_cyccnt;
+	if (now < cycles_last)
+		cycles_high += 1ull << 32;
+	cycles_last = now;
+	return cycles_high | now;
+#else
+	// No cycle counter on the M0+, fall back to the microsecond timer
+	return time_us_64() * (cpu_clk / 1000000);
+#endif
+}
+
+// Must be called with interrupts disabled or from the interrupt
+void push_event(event_type_t type, uint group, uint32_t value) {
+	if (event_wr - event_rd == EVENT_QUEUE_LEN) {
+		events_lost++;
+		return;
+	}
+
+	event_t* e = &event_queue[event_wr % EVENT_QUEUE_LEN];
+	e->type = type;
+	e->group = group;
+	e->value = value;
+	e->cycles = read_cycles();
+	event_wr++;
+}
+
+// Shared DMA_IRQ_0 handler, only the output channels of the groups raise it
+void events_dma_irq() {
+	for (uint i = 0; i < n_groups; i++) {
+		pulse_group_t* g = &groups[i];
+		if (!dma_channel_get_irq0_status(g->dma))
+			continue;
+		dma_channel_acknowledge_irq0(g->dma);
+
+		// The main loop restarts the DMA and decrements the loop count only after this,
+		// so a run is over if nothing is left of it at the end of a repetition
+		g->passes++;
+		if (g->loop == 0 && g->pending == 0) {
+			push_event(EVENT_DONE, i, g->passes);
+			g->passes = 0;
+		}
+		else if (events_every != 0 && g->passes % events_every == 0) {
+			push_event(EVENT_PASS, i, g->passes);
+		}
+	}
+}
+
+void enable_events(bool enabled) {
+	if (enabled && !events_irq_added) {
+#if PICO_RP2350
+		// Start the cycle counter
+		m33_hw->demcr |= M33_DEMCR_TRCENA_BITS;
+		m33_hw->dwt_ctrl |= M33_DWT_CTRL_CYCCNTENA_BITS;
+#endif
+		irq_add_shared_handler(DMA_IRQ_0, events_dma_irq, PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+		irq_set_enabled(DMA_IRQ_0, true);
+		events_irq_added = true;
+	}
+
+	uint32_t irq = save_and_disable_interrupts();
+	events_enabled = enabled;
+	event_rd = event_wr;
+	events_lost = 0;
+	for (uint i = 0; i < n_groups; i++) {
+		groups[i].passes = 0;
+		// Completions from before are still flagged in the raw status
+		dma_channel_acknowledge_irq0(groups[i].dma);
+		dma_channel_set_irq0_enabled(groups[i].dma, enabled);
+	}
+	restore_interrupts(irq);
+
+	count_overrun_prev = count_overrun;
+	box_overrun_prev = box_overrun;
+}
+
+// Called in the main loop, queues the errors found there and prints the next event
+void events_task() {
+	if (!events_enabled)
+		return;
+
+	uint32_t irq = save_and_disable_interrupts();
+	// Errors are reported once, when their flag gets set
+	if (count_overrun && !count_overrun_prev)
+		push_event(EVENT_COUNTER, 0, 0);
+	if (box_overrun && !box_overrun_prev)
+		push_event(EVENT_BOXCAR, 0, 0);
+	// Keep the cycle counter extension up to date, even if there are no events
+	read_cycles();
+	restore_interrupts(irq);
+
+	count_overrun_prev = count_overrun;
+	box_overrun_prev = box_overrun;
+
+	if (event_rd == event_wr || time_us_32() - event_last_us < EVENT_MIN_INTERVAL_US)
+		return;
+	event_last_us = time_us_32();
+
+	if (events_lost != 0) {
+		printf("EVENT:LOST %lu\n", events_lost);
+		events_lost = 0;
+		return;
+	}
+
+	event_t e = event_queue[event_rd % EVENT_QUEUE_LEN];
+	event_rd++;
+
+	switch (e.type) {
+	case EVENT_DONE:
+		printf("EVENT:DONE %u,%lu,%llu\n", e.group, e.value, e.cycles);
+		break;
+	case EVENT_PASS:
+		printf("EVENT:PASS %u,%lu,%llu\n", e.group, e.value, e.cycles);
+		break;
+	case EVENT_COUNTER:
+		printf("EVENT:ERROR COUNTER,%llu\n", e.cycles);
+		break;
+	case EVENT_BOXCAR:
+		printf("EVENT:ERROR BOXCAR,%llu\n", e.cycles);
+		break;
+	}
+}
+
+// EVENTS s [k]
+// Turn events on or off, with a milestone every k repetitions
+void set_events_cmd(char* next_token) {
+	char* tmp;
+	uint32_t s;
+	uint32_t k = 0;
+
+	tmp = strtok_r(NULL, " ", &next_token);
+	if (!tmp) {
+		printf("Error: s parameter could not be parsed.\n");
+		return;
+	}
+	s = strtoul(tmp, NULL, 10);
+
+	tmp = strtok_r(NULL, " ", &next_token);
+	if (tmp)
+		k = strtoul(tmp, NULL, 10);
+
+	events_every = k;
+	enable_events(s != 0);
+	printf("ACK\n");
+}
+
+// EVENTS?
+void get_events_cmd() {
+	printf("%d,%lu\n", events_enabled ? 1 : 0, events_every);
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+#include "pico/stdlib.h"
+
+void enable_events(bool enabled);
+void events_task(void);
+
+void set_events_cmd(char* next_token);
+void get_events_cmd(void);
@@ -0,0 +1,387 @@
+// Copyright (c) 2026 Bence Göblyös
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "pico/stdlib.h"
+#include "pico/flash.h"
+#include "hardware/flash.h"
+#include "hardware/dma.h"
+
+#include "flashseq.h"
+#include "hardware.h"
+#include "pulse.h"
+#include "counter.h"
+#include "boxcar.h"
+
+// Pull in CPU clock rate from main.c
+extern uint32_t cpu_clk;
+
+// Pull in PIO variables from main.c
+extern const uint32_t pio_extra_cycles;
+extern const uint pio_n_gpio;
+
+// Pull in channel groups from hardware.c
+extern pulse_group_t groups[];
+extern uint n_groups;
+extern uint cur_group;
+extern bool sync_start;
+
+// End of the firmware in flash, provided by the linker
+extern char __flash_binary_end;
+
+// Sequences too long for pio_buf can be stored as a pre-encoded image in the upper half of the flash
+// and played by DMA straight from the XIP address range. The first sector holds the header.
+#define FLASH_SEQ_OFFSET (PICO_FLASH_SIZE_BYTES / 2)
+#define FLASH_SEQ_DATA_OFFSET (FLASH_SEQ_OFFSET + FLASH_SECTOR_SIZE)
+#define FLASH_SEQ_MAX_LEN ((PICO_FLASH_SIZE_BYTES - FLASH_SEQ_DATA_OFFSET) / sizeof(uint32_t))
+#define FLASH_SEQ_MAGIC 0x51455350
+
+typedef struct {
+	uint32_t magic;
+	uint32_t len;        // Length of the image in words
+	uint32_t entries;    // Number of source (time, mask) entries
+	uint32_t first_ch;   // Layout of the group the masks were encoded for
+	uint32_t n_ch;
+	uint32_t min_window;  // Shortest total length of FLASH_WINDOW_LEN consecutive words, in cycles
+} flash_seq_header_t;
+
+// Read through the uncached alias, so playing the image doesn't evict code from the XIP cache
+#define flash_seq_header ((const flash_seq_header_t*)(XIP_NOCACHE_NOALLOC_BASE + FLASH_SEQ_OFFSET))
+#define flash_seq_data ((const uint32_t*)(XIP_NOCACHE_NOALLOC_BASE + FLASH_SEQ_DATA_OFFSET))
+
+// Entries are encoded into a sector sized staging buffer, which is programmed once it's full.
+// The slack holds the rest of an entry that is split into several words across the sector boundary,
+// entries that need even more words are flushed in parts, see append_entry.
+#define SECTOR_WORDS (FLASH_SECTOR_SIZE / sizeof(uint32_t))
+#define STAGE_SLACK 256
+#define STAGE_LEN (SECTOR_WORDS + STAGE_SLACK)
+uint32_t flash_stage[STAGE_LEN];
+uint32_t flash_stage_len = 0;
+
+bool flash_writing = false;     // Set between FLASH:BEGIN and FLASH:END
+uint32_t flash_written = 0;     // Number of words programmed into the image so far
+uint32_t flash_entries = 0;     // Number of entries appended so far
+uint flash_first_ch;
+uint flash_n_ch;
+
+// The PIO can only bridge slow flash reads with its Tx FIFO, so the image is checked for the shortest run
+// of consecutive words as deep as the FIFO (8 words, pulse_program_init joins the Rx FIFO to it),
+// rather than the average over the whole image
+#define FLASH_WINDOW_LEN 8
+uint32_t flash_window[FLASH_WINDOW_LEN];    // Length of the last words programmed, in cycles
+uint32_t flash_window_sum = 0;
+uint32_t flash_min_window = 0;
+
+// Number of words read in the bandwidth measurement
+#define FLASH_BENCH_LEN 16384
+
+typedef struct {
+	uint32_t offset;
+	const uint8_t* data;    // NULL for erasing
+	size_t len;
+} flash_op_t;
+
+// Called through flash_safe_execute, so nothing else runs from flash in the meantime
+void flash_op(void* param) {
+	flash_op_t* op = (flash_op_t*)param;
+	if (op->data)
+		flash_range_program(op->offset, op->data, op->len);
+	else
+		flash_range_erase(op->offset, op->len);
+}
+
+bool flash_execute(uint32_t offset, const uint8_t* data, size_t len, char* err) {
+	flash_op_t op = {offset, data, len};
+	if (flash_safe_execute(flash_op, &op, 100) != PICO_OK) {
+		strcpy(err, "Flash could not be accessed.");
+		return false;
+	}
+	return true;
+}
+
+bool flash_image_valid() {
+	return flash_seq_header->magic == FLASH_SEQ_MAGIC && flash_seq_header->len <= FLASH_SEQ_MAX_LEN;
+}
+
+// Add word i of the image to the sliding window and update the shortest window seen
+void track_window(uint32_t i, uint32_t word) {
+	uint32_t cycles = (word >> pio_n_gpio) + pio_extra_cycles;
+
+	flash_window_sum -= flash_window[i % FLASH_WINDOW_LEN];
+	flash_window_sum += cycles;
+	flash_window[i % FLASH_WINDOW_LEN] = cycles;
+
+	if (i + 1 >= FLASH_WINDOW_LEN && flash_window_sum < flash_min_window)
+		flash_min_window = flash_window_sum;
+}
+
+// Program a sector from the staging buffer and keep whatever didn't fit.
+// A partly filled buffer is programmed as a whole sector, the rest is padding.
+bool flush_sector(char* err) {
+	if (flash_written + SECTOR_WORDS > FLASH_SEQ_MAX_LEN) {
+		strcpy(err, "Image doesn't fit in the reserved flash region!");
+		return false;
+	}
+
+	uint32_t offset = FLASH_SEQ_DATA_OFFSET + flash_written * sizeof(uint32_t);
+	if (!flash_execute(offset, NULL, FLASH_SECTOR_SIZE, err)
+	    || !flash_execute(offset, (const uint8_t*)flash_stage, FLASH_SECTOR_SIZE, err))
+		return false;
+
+	uint32_t n = flash_stage_len < SECTOR_WORDS ? flash_stage_len : SECTOR_WORDS;
+	for (uint32_t j = 0; j < n; j++)
+		track_window(flash_written + j, flash_stage[j]);
+	flash_written += n;
+	flash_stage_len -= n;
+	memmove(flash_stage, flash_stage + n, flash_stage_len * sizeof(flash_stage[0]));
+	return true;
+}
+
+// Encode a single entry into the staging buffer. An entry that's split into more words than the buffer has room for
+// is encoded in parts of whole words, programming a sector after each part. The last part keeps at least one full word,
+// so encode_entry can still fold a short remainder into it and the length stays exact.
+bool append_entry(uint64_t delay, uint32_t out, char* err) {
+	uint64_t max_cycles = (1 << (32 - pio_n_gpio)) - 1 + pio_extra_cycles;
+
+	while (delay / max_cycles + 1 > STAGE_LEN - flash_stage_len) {
+		uint32_t part = STAGE_LEN - flash_stage_len - 1;
+		if (encode_entry(part * max_cycles, out, flash_stage, STAGE_LEN, &flash_stage_len, err) == PARSER_FAILURE
+		    || !flush_sector(err))
+			return false;
+		delay -= part * max_cycles;
+	}
+
+	if (encode_entry(delay, out, flash_stage, STAGE_LEN, &flash_stage_len, err) == PARSER_FAILURE)
+		return false;
+
+	return flash_stage_len < SECTOR_WORDS || flush_sector(err);
+}
+
+// Time unpaced DMA reads from the image region in words per second. The PIO can't be fed any faster than this.
+// The reads would compete with a group playing the image and could make it run dry, so the result of the last
+// measurement is returned instead while that is the case (0 if there hasn't been one).
+uint32_t measure_flash_bandwidth() {
+	static uint32_t sink;
+	static uint32_t words_per_s = 0;
+
+	for (uint i = 0; i < n_groups; i++)
+		if (groups[i].src == flash_seq_data && group_busy(&groups[i]) == 2)
+			return words_per_s;
+
+	int ch = dma_claim_unused_channel(false);
+	if (ch < 0)
+		return words_per_s;
+
+	dma_channel_config c = dma_channel_get_default_config(ch);
+	channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+	channel_config_set_read_increment(&c, true);
+	channel_config_set_write_increment(&c, false);
+
+	uint32_t t_start = time_us_32();
+	dma_channel_configure(ch, &c, &sink, flash_seq_data, FLASH_BENCH_LEN, true);
+	dma_channel_wait_for_finish_blocking(ch);
+	uint32_t t_elapsed = time_us_32() - t_start;
+
+	dma_channel_unclaim(ch);
+
+	words_per_s = t_elapsed ? (uint64_t)FLASH_BENCH_LEN * 1000000 / t_elapsed : 0;
+	return words_per_s;
+}
+
+// Print the bandwidth and the shortest average pulse duration it can sustain
+void print_flash_bandwidth() {
+	uint32_t words_per_s = measure_flash_bandwidth();
+	double min_avg_ns = words_per_s ? 1e9 / words_per_s : 0;
+	double min_pulse_ns = 1e9 * pio_extra_cycles / cpu_clk;
+
+	printf("words_per_s = %lu, min_avg_ns = %.1f", words_per_s, min_avg_ns > min_pulse_ns ? min_avg_ns : min_pulse_ns);
+}
+
+// Average word duration of a window of FLASH_WINDOW_LEN words at the current clock
+double window_avg_ns(uint32_t window) {
+	return 1e9 * window / FLASH_WINDOW_LEN / cpu_clk;
+}
+
+// FLASH:BEGIN
+// Invalidate the stored image and start writing a new one for the current group
+void flash_begin_cmd() {
+	static char err[256];
+	pulse_group_t* g = &groups[cur_group];
+
+	if ((uintptr_t)&__flash_binary_end - XIP_BASE > FLASH_SEQ_OFFSET) {
+		printf("Error: Firmware overlaps the reserved flash region!\n");
+		return;
+	}
+
+	// Groups can't play the image while it's being rewritten
+	for (uint i = 0; i < n_groups; i++)
+		if (groups[i].src == flash_seq_data) {
+			stop_group(&groups[i]);
+			reset_group_sequence(&groups[i]);
+		}
+
+	flash_writing = false;
+	if (!flash_execute(FLASH_SEQ_OFFSET, NULL, FLASH_SECTOR_SIZE, err)) {
+		printf("Error: %s\n", err);
+		return;
+	}
+
+	flash_stage_len = 0;
+	flash_written = 0;
+	flash_entries = 0;
+	memset(flash_window, 0, sizeof(flash_window));
+	flash_window_sum = 0;
+	flash_min_window = ~(uint32_t)0;
+	flash_first_ch = g->first_ch;
+	flash_n_ch = g->n_ch;
+	flash_writing = true;
+
+	printf("ACK\n");
+}
+
+// FLASH:APPEND t1,p1,t2,p2,... and FLASH:CAPPEND
+// Encode entries the same way as PULSE and add them to the image
+void flash_append_cmd(char* next_token, bool time_in_cycles) {
+	static char err[256];
+	static uint64_t time;
+	static uint64_t delay;
+	static uint32_t out;
+	pulse_group_t* g = &groups[cur_group];
+	uint32_t rc;
+
+	if (!flash_writing) {
+		printf("Error: No image is being written, send FLASH:BEGIN first.\n");
+		return;
+	}
+
+	if (g->first_ch != flash_first_ch || g->n_ch != flash_n_ch) {
+		printf("Error: Current group doesn't match the one the image was started for!\n");
+		return;
+	}
+
+	while ((rc = read_entry(&next_token, g, &time, &out, err)) == PARSER_SUCCESS) {
+		if (!time_to_cycles(time, &delay, err, time_in_cycles) || !append_entry(delay, out, err)) {
+			rc = PARSER_FAILURE;
+			break;
+		}
+		flash_entries++;
+	}
+
+	if (rc == PARSER_FAILURE) {
+		// The image can't be trusted after a failed entry, it has to be started again
+		flash_writing = false;
+		printf("Error: %s\n", err);
+		return;
+	}
+
+	printf("OK, l = %lu, entries = %lu\n", flash_written + flash_stage_len, flash_entries);
+}
+
+// FLASH:END
+// Program the rest of the image and its header
+void flash_end_cmd() {
+	static char err[256];
+	static uint8_t page[FLASH_PAGE_SIZE];
+
+	if (!flash_writing) {
+		printf("Error: No image is being written, send FLASH:BEGIN first.\n");
+		return;
+	}
+	flash_writing = false;
+
+	uint32_t len = flash_written + flash_stage_len;
+	if (len == 0) {
+		printf("Error: Image is empty!\n");
+		return;
+	}
+
+	// The last sector is padded with whatever is left in the staging buffer
+	if (flash_stage_len != 0 && !flush_sector(err)) {
+		printf("Error: %s\n", err);
+		return;
+	}
+
+	// An image shorter than the window is played back-to-back with itself
+	if (len < FLASH_WINDOW_LEN)
+		flash_min_window = flash_window_sum * FLASH_WINDOW_LEN / len;
+
+	flash_seq_header_t header = {FLASH_SEQ_MAGIC, len, flash_entries, flash_first_ch, flash_n_ch, flash_min_window};
+	memset(page, 0xFF, sizeof(page));
+	memcpy(page, &header, sizeof(header));
+	if (!flash_execute(FLASH_SEQ_OFFSET, page, FLASH_PAGE_SIZE, err)) {
+		printf("Error: %s\n", err);
+		return;
+	}
+
+	printf("OK, l = %lu, entries = %lu, min_window_ns = %.1f, ", len, flash_entries, window_avg_ns(flash_min_window));
+	print_flash_bandwidth();
+	printf("\n");
+}
+
+// FLASH:RUN n
+// Play the stored image n times on the current group
+void flash_run_cmd(char* next_token) {
+	pulse_group_t* g = &groups[cur_group];
+	char* tmp;
+	uint32_t n;
+
+	tmp = strtok_r(NULL, " ", &next_token);
+	if (!tmp) {
+		printf("Error: n parameter could not be parsed.\n");
+		return;
+	}
+	n = strtoul(tmp, NULL, 10);
+
+	if (flash_writing || !flash_image_valid()) {
+		printf("Error: No image has been stored in flash!\n");
+		return;
+	}
+
+	if (g->first_ch != flash_seq_header->first_ch || g->n_ch != flash_seq_header->n_ch) {
+		printf("Error: Current group doesn't match the one the image was written for!\n");
+		return;
+	}
+
+	// If the words of the shortest window can't be read in time, the FIFO runs dry and the pulses get stretched
+	uint32_t words_per_s = measure_flash_bandwidth();
+	double read_ns = words_per_s ? 1e9 / words_per_s : 0;
+	double min_window_ns = window_avg_ns(flash_seq_header->min_window);
+	if (min_window_ns < read_ns) {
+		printf("Error: Image has pulses averaging %.1f ns over %d words, but reading a word from flash takes %.1f ns!\n",
+		       min_window_ns, FLASH_WINDOW_LEN, read_ns);
+		return;
+	}
+
+	// The sequence in the group's region is dropped, the image takes its place
+	stop_group(g);
+	reset_group_sequence(g);
+	g->src = flash_seq_data;
+	g->dma_count = flash_seq_header->len;
+
+	// With synchronized starts, the repetitions wait for START
+	if (sync_start)
+		g->pending = n;
+	else
+		g->loop = n;
+
+	// The counter and boxcar follow the sequence in the region, which is gone
+	clear_counter_group(g);
+	clear_boxcar_group(g);
+
+	printf("OK, l = %lu, n = %lu\n", (uint32_t)g->dma_count, n);
+}
+
+// FLASH?
+void get_flash_cmd() {
+	if (!flash_writing && flash_image_valid())
+		printf("l = %lu, entries = %lu, group_ch = %lu:%lu, min_window_ns = %.1f, ", flash_seq_header->len, flash_seq_header->entries,
+		       flash_seq_header->first_ch, flash_seq_header->n_ch, window_avg_ns(flash_seq_header->min_window));
+	else
+		printf("l = 0, ");
+	printf("max_l = %lu, ", (uint32_t)FLASH_SEQ_MAX_LEN);
+	print_flash_bandwidth();
+	printf("\n");
+}
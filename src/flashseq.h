@@ -0,0 +1,11 @@
+#pragma once
+
+#include "pico/stdlib.h"
+
+uint32_t measure_flash_bandwidth(void);
+
+void flash_begin_cmd(void);
+void flash_append_cmd(char* next_token, bool time_in_cycles);
+void flash_end_cmd(void);
+void flash_run_cmd(char* next_token);
+void get_flash_cmd(void);
@@ -1,106 +1,498 @@
 // Copyright (c) 2025 Bence Göblyös
 // SPDX-License-Identifier: GPL-3.0-or-later
 
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
 #include "hardware.h"
+#include "playlist.h"
+#include "counter.h"
+#include "boxcar.h"
 
 #include "hardware/pio.h"
 #include "hardware/dma.h"
+#include "hardware/sync.h"
 #include "pico-pulse.pio.h"
 
 // Pull in PIO related constants from main.c
 extern uint32_t pio_buf[];
+extern uint32_t pio_entry_map[];
 extern const uint32_t pio_buf_len;
 extern const uint32_t pio_extra_cycles;
 extern const uint pio_base_gpio;
 extern const uint pio_n_gpio;
 
-// PIO global variables
+// PIO global variables, all groups share the same PIO block and program
 PIO pio;
-uint sm;
 uint offset;
 
-// DMA global variables
-int dma;
-dma_channel_config dma_conf;
-uint dma_count = 0;
-
-// Store some data that was #defined in main
+// Channel groups, by default a single group covers all channels and the whole buffer
+pulse_group_t groups[MAX_GROUPS];
+uint n_groups = 1;
+uint cur_group = 0;     // Group targeted by the sequence commands
+bool sync_start = false; // If set, sequences wait for START instead of starting immediately
 
 // DMA looping flags, mostly used in main but required for stop_all
-extern uint32_t loop;
 extern const uint32_t loop_inf_val;
 
+// Pull in event reporting flag from events.c
+extern bool events_enabled;
+
 void init_pio() {
 	// Find a free pio and state machine and add the program
     bool rc = pio_claim_free_sm_and_add_program_for_gpio_range(
 		&pulse_program,
 		&pio,
-		&sm,
+		&groups[0].sm,
 		&offset,
 		pio_base_gpio,
 		pio_n_gpio,
 		true
 	);
     hard_assert(rc);
+}
+
+void init_dma() {
+    // Claim DMA channel of the first group and set it up to cover all channels
+    groups[0].dma = dma_claim_unused_channel(true);
+    init_group(&groups[0], 0, pio_n_gpio, pio_buf, pio_buf_len);
+}
+
+// Set up the state machine and DMA config of a group. The state machine
+// and DMA channel have to be claimed already.
+void init_group(pulse_group_t* g, uint first_ch, uint n_ch, uint32_t* buf, uint32_t buf_len) {
+    g->first_ch = first_ch;
+    g->n_ch = n_ch;
+    g->buf = buf;
+    g->entry_map = pio_entry_map + (buf - pio_buf) / 32;
+    g->buf_len = buf_len;
+    g->loop = 0;
+    g->pending = 0;
+    g->passes = 0;
+    reset_group_sequence(g);
 
     // Initialize state machine
-    pulse_program_init(pio, sm, offset, pio_base_gpio, pio_n_gpio);
-    
+    pio_sm_set_enabled(pio, g->sm, false);
+    pulse_program_init(pio, g->sm, offset, pio_base_gpio + first_ch, n_ch);
+
     // clear FIFO
-    pio_sm_clear_fifos(pio, sm);
+    pio_sm_clear_fifos(pio, g->sm);
 
     // enable state machine
-    pio_sm_set_enabled(pio, sm, true);
-}
+    pio_sm_set_enabled(pio, g->sm, true);
 
-void init_dma() {
-    // Claim DMA channel
-    dma = dma_claim_unused_channel(true);
     // Get default config
-    dma_conf = dma_channel_get_default_config(dma);
+    g->dma_conf = dma_channel_get_default_config(g->dma);
     // Set DMA width to 32 bits
-    channel_config_set_transfer_data_size(&dma_conf, DMA_SIZE_32);
+    channel_config_set_transfer_data_size(&g->dma_conf, DMA_SIZE_32);
     // Increment read address
-    channel_config_set_read_increment(&dma_conf, true);
+    channel_config_set_read_increment(&g->dma_conf, true);
     // Do not increment write address
-    channel_config_set_write_increment(&dma_conf, false);
+    channel_config_set_write_increment(&g->dma_conf, false);
     // Connect to FIFO Tx request signals
-    channel_config_set_dreq(&dma_conf, pio_get_dreq(pio, sm, true));
+    channel_config_set_dreq(&g->dma_conf, pio_get_dreq(pio, g->sm, true));
+    // Take precedence over the DMA channels of the counter and boxcar, so they can't disturb the output timing
+    channel_config_set_high_priority(&g->dma_conf, true);
+
+    // Raise DMA_IRQ_0 at the end of each run if events are on
+    dma_channel_acknowledge_irq0(g->dma);
+    dma_channel_set_irq0_enabled(g->dma, events_enabled);
+}
+
+// Forget the sequence stored in the group's region
+void reset_group_sequence(pulse_group_t* g) {
+    g->src = g->buf;
+    g->playlist = false;
+    g->dma_count = 0;
+    g->seq_len = 0;
+    g->seq_entries = 0;
+    g->seq_m = 0;
+    g->seq_m_target = 0;
+}
+
+// Split the channels into k groups of n_ch[i] consecutive channels. Each group gets buf_len[i] words
+// of the buffer, or an equal share of what's left if buf_len[i] is 0. Stops the output and clears all sequences.
+bool configure_groups(uint k, const uint* n_ch, const uint32_t* buf_len, char* err) {
+    uint ch = 0;
+    uint32_t explicit_len = 0;
+    uint implicit = 0;
+
+    if (k == 0 || k > MAX_GROUPS) {
+        strcpy(err, "Number of groups is invalid!");
+        return false;
+    }
+
+    for (uint i = 0; i < k; i++) {
+        if (n_ch[i] == 0) {
+            strcpy(err, "Groups must have at least one channel!");
+            return false;
+        }
+        // Regions start on a multiple of 32 words, so their entry maps are word aligned
+        if (buf_len[i] % 32 != 0) {
+            strcpy(err, "Buffer lengths must be multiples of 32!");
+            return false;
+        }
+        ch += n_ch[i];
+        explicit_len += buf_len[i];
+        if (buf_len[i] == 0)
+            implicit++;
+    }
+
+    if (ch != pio_n_gpio) {
+        strcpy(err, "Groups must cover all channels exactly once!");
+        return false;
+    }
+
+    if (explicit_len > pio_buf_len || (implicit != 0 && explicit_len == pio_buf_len)) {
+        strcpy(err, "Buffer lengths don't fit in the buffer!");
+        return false;
+    }
+
+    uint32_t share = implicit != 0 ? ((pio_buf_len - explicit_len) / implicit) & ~31u : 0;
+    if (implicit != 0 && share == 0) {
+        strcpy(err, "Not enough buffer left for the groups without a length!");
+        return false;
+    }
+
+    stop_all();
+
+    // Release the state machines and DMA channels of the extra groups
+    for (uint i = 1; i < n_groups; i++) {
+        pio_sm_set_enabled(pio, groups[i].sm, false);
+        pio_sm_unclaim(pio, groups[i].sm);
+        dma_channel_set_irq0_enabled(groups[i].dma, false);
+        dma_channel_unclaim(groups[i].dma);
+    }
+    n_groups = 1;
+
+    // Claim resources for the new ones. The first group always keeps its own.
+    for (uint i = 1; i < k; i++) {
+        int sm_new = pio_claim_unused_sm(pio, false);
+        if (sm_new < 0) {
+            // Fall back to a single group, so the device stays usable
+            for (uint j = 1; j < i; j++) {
+                pio_sm_unclaim(pio, groups[j].sm);
+                dma_channel_set_irq0_enabled(groups[j].dma, false);
+                dma_channel_unclaim(groups[j].dma);
+            }
+            init_group(&groups[0], 0, pio_n_gpio, pio_buf, pio_buf_len);
+            cur_group = 0;
+            clear_counter();
+            clear_boxcar();
+            strcpy(err, "Not enough free state machines for the groups.");
+            return false;
+        }
+        groups[i].sm = sm_new;
+        groups[i].dma = dma_claim_unused_channel(true);
+    }
+
+    uint32_t* buf = pio_buf;
+    ch = 0;
+    for (uint i = 0; i < k; i++) {
+        uint32_t len = buf_len[i] != 0 ? buf_len[i] : share;
+        init_group(&groups[i], ch, n_ch[i], buf, len);
+        ch += n_ch[i];
+        buf += len;
+    }
+
+    n_groups = k;
+    cur_group = 0;
+
+    // The sequences are gone, so the gates and windows of the counter and boxcar are too
+    clear_counter();
+    clear_boxcar();
+    return true;
+}
+
+// Index of the group containing the given output channel
+uint group_of_channel(uint ch) {
+    for (uint i = 0; i < n_groups; i++)
+        if (ch >= groups[i].first_ch && ch < groups[i].first_ch + groups[i].n_ch)
+            return i;
+    return 0;
+}
+
+// Number of words in a single DMA run. Runs from the group's region can't go past its end.
+uint32_t group_transfer_count(pulse_group_t* g) {
+    if (g->src == g->buf && g->dma_count > g->buf_len)
+        return g->buf_len;
+    return g->dma_count;
+}
+
+// Check whether the DMA of the group is still working on the current repetition
+bool group_dma_busy(pulse_group_t* g) {
+    if (g->playlist)
+        return playlist_busy(g);
+    return dma_channel_is_busy(g->dma);
 }
 
-void start_dma() {
+void start_dma(pulse_group_t* g) {
+    if (g->playlist) {
+        dma_channel_start(playlist_configure(g));
+        return;
+    }
+
     dma_channel_configure(
-        dma,
-        &dma_conf,
-        &pio->txf[sm],
-        pio_buf,
-        dma_encode_transfer_count(dma_count < pio_buf_len ? dma_count : pio_buf_len),
+        g->dma,
+        &g->dma_conf,
+        &pio->txf[g->sm],
+        g->src,
+        dma_encode_transfer_count(group_transfer_count(g)),
         true
     );
 };
 
-// Stop DMA and flush PIO FIFO
-void stop_all() {
+// Start every group with pending repetitions on the same clock cycle
+void start_groups_in_sync() {
+    uint32_t sm_mask = 0;
+    uint32_t dma_mask = 0;
+
+    for (uint i = 0; i < n_groups; i++) {
+        pulse_group_t* g = &groups[i];
+        if (g->pending == 0 || g->dma_count == 0)
+            continue;
+
+        // Hold the state machine at the top of the program
+        pio_sm_set_enabled(pio, g->sm, false);
+        pio_sm_clear_fifos(pio, g->sm);
+        pio_sm_restart(pio, g->sm);
+        pio_sm_exec(pio, g->sm, pio_encode_jmp(offset));
+
+        if (g->playlist) {
+            dma_mask |= 1u << playlist_configure(g);
+        }
+        else {
+            dma_channel_configure(
+                g->dma,
+                &g->dma_conf,
+                &pio->txf[g->sm],
+                g->src,
+                dma_encode_transfer_count(group_transfer_count(g)),
+                false
+            );
+            dma_mask |= 1u << g->dma;
+        }
+
+        sm_mask |= 1u << g->sm;
+    }
+
+    if (sm_mask == 0)
+        return;
+
+    // A run of only a few words can complete while the FIFO is preloaded. The completion interrupt is held off
+    // until the repetitions are released below, otherwise it would see them pending and never report DONE.
+    uint32_t irq = save_and_disable_interrupts();
+
+    // Let the DMA fill the FIFOs first, so none of the groups runs dry right after the start
+    dma_start_channel_mask(dma_mask);
+    for (uint i = 0; i < n_groups; i++) {
+        pulse_group_t* g = &groups[i];
+        if (!(sm_mask & (1u << g->sm)))
+            continue;
+        while (group_dma_busy(g) && !pio_sm_is_tx_fifo_full(pio, g->sm))
+            tight_loop_contents();
+    }
+
+    pio_enable_sm_mask_in_sync(pio, sm_mask);
+
+    // The first repetition has just been started
+    for (uint i = 0; i < n_groups; i++) {
+        pulse_group_t* g = &groups[i];
+        if (!(sm_mask & (1u << g->sm)))
+            continue;
+        g->loop = g->pending == loop_inf_val ? loop_inf_val : g->pending - 1;
+        g->pending = 0;
+    }
+
+    restore_interrupts(irq);
+}
+
+// Stop DMA and flush PIO FIFO of a single group
+void stop_group(pulse_group_t* g) {
 	// Turn off infinite DMA looping and set loop count to 0
-	loop = 0;
+	g->loop = 0;
+	g->pending = 0;
     // Disable state machine
-	pio_sm_set_enabled(pio, sm, true);
-	// Stop DMA
-	dma_channel_abort(dma);
+	pio_sm_set_enabled(pio, g->sm, true);
+	// Stop DMA, without the abort being reported as a finished run.
+	// A playlist is stopped along with it, so the control channel can't retrigger the DMA.
+	dma_channel_set_irq0_enabled(g->dma, false);
+	if (g->playlist)
+		stop_playlist(g);
+	dma_channel_abort(g->dma);
+	dma_channel_acknowledge_irq0(g->dma);
+	dma_channel_set_irq0_enabled(g->dma, events_enabled);
+	g->passes = 0;
 	// Clear FIFO
-    pio_sm_clear_fifos(pio, sm);
+    pio_sm_clear_fifos(pio, g->sm);
     // Re-enable state machine
-    pio_sm_set_enabled(pio, sm, true);
+    pio_sm_set_enabled(pio, g->sm, true);
 	// Send a zero to the PIO to disable all outputs
-	pio_sm_put_blocking(pio, sm, 0);
+	pio_sm_put_blocking(pio, g->sm, 0);
 }
 
-uint32_t is_busy() {
-	if (loop != 0 || dma_channel_is_busy(dma)) {
+// Stop every group
+void stop_all() {
+    for (uint i = 0; i < n_groups; i++)
+        stop_group(&groups[i]);
+}
+
+uint32_t group_busy(pulse_group_t* g) {
+	if (g->loop != 0 || group_dma_busy(g)) {
 		return 2; // DMA is busy
-	} else if (!pio_sm_is_tx_fifo_empty(pio, sm)) {
+	} else if (!pio_sm_is_tx_fifo_empty(pio, g->sm)) {
 		return 1; // PIO is busy but DMA is idle
 	} else {
 		return 0; // Nothing is busy
 	}
 }
+
+// Busiest state among all groups
+uint32_t is_busy() {
+    uint32_t busy = 0;
+    uint32_t tmp;
+
+    for (uint i = 0; i < n_groups; i++) {
+        tmp = group_busy(&groups[i]);
+        busy = tmp > busy ? tmp : busy;
+    }
+
+    return busy;
+}
+
+// Claim the channels of a ring DMA and set them up to move transfers of the given size from src into the ring
+void ring_dma_init(ring_dma_t* r, volatile void* ring, uint ring_bits, enum dma_channel_transfer_size size, const volatile void* src, uint dreq) {
+    r->dma = dma_claim_unused_channel(true);
+    r->reload = dma_claim_unused_channel(true);
+    r->ring_len = (1u << ring_bits) >> size;
+
+    r->conf = dma_channel_get_default_config(r->dma);
+    channel_config_set_transfer_data_size(&r->conf, size);
+    // Do not increment read address
+    channel_config_set_read_increment(&r->conf, false);
+    // Increment write address, wrapping around the ring
+    channel_config_set_write_increment(&r->conf, true);
+    channel_config_set_ring(&r->conf, true, ring_bits);
+    channel_config_set_dreq(&r->conf, dreq);
+    // Restart through the reload channel at the end of each run
+    channel_config_set_chain_to(&r->conf, r->reload);
+
+    r->ring = ring;
+    r->src = src;
+    r->reload_count = RING_DMA_LEN;
+}
+
+void ring_dma_start(ring_dma_t* r) {
+    // At the end of a run, the read address of the data channel is unchanged and its write address
+    // has wrapped back to the start of the ring, so only the transfer count has to be written again.
+    // Writing it through alias 1 triggers the channel.
+    dma_channel_config c = dma_channel_get_default_config(r->reload);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+    channel_config_set_read_increment(&c, false);
+    channel_config_set_write_increment(&c, false);
+    dma_channel_configure(r->reload, &c, &dma_hw->ch[r->dma].al1_transfer_count_trig, &r->reload_count, 1, false);
+
+    dma_channel_configure(r->dma, &r->conf, r->ring, r->src, RING_DMA_LEN, true);
+}
+
+void ring_dma_stop(ring_dma_t* r) {
+    // Break the chain before aborting, so the channels don't re-trigger each other
+    dma_channel_config c = r->conf;
+    channel_config_set_chain_to(&c, r->dma);
+    dma_channel_set_config(r->dma, &c, false);
+    dma_channel_abort(r->reload);
+    dma_channel_abort(r->dma);
+}
+
+void ring_dma_release(ring_dma_t* r) {
+    ring_dma_stop(r);
+    dma_channel_unclaim(r->dma);
+    dma_channel_unclaim(r->reload);
+    r->dma = -1;
+    r->reload = -1;
+}
+
+// Position of the data channel with the given remaining transfer count, modulo RING_DMA_LEN
+uint32_t ring_dma_count_to_pos(uint32_t transfer_count) {
+    return (RING_DMA_LEN - (transfer_count & 0x0FFFFFFF)) & (RING_DMA_LEN - 1);
+}
+
+// Number of transfers done, modulo RING_DMA_LEN
+uint32_t ring_dma_pos(ring_dma_t* r) {
+    return ring_dma_count_to_pos(dma_hw->ch[r->dma].transfer_count);
+}
+
+// GROUPS c1[:l1] c2[:l2] ...
+void set_groups_cmd(char* next_token) {
+    static char err[256];
+    char* tmp;
+    char* len;
+    uint n_ch[MAX_GROUPS];
+    uint32_t buf_len[MAX_GROUPS];
+    uint k = 0;
+
+    while ((tmp = strtok_r(NULL, " ", &next_token))) {
+        if (k == MAX_GROUPS) {
+            printf("Error: too many groups, at most %d are supported.\n", MAX_GROUPS);
+            return;
+        }
+        n_ch[k] = strtoul(tmp, &len, 10);
+        buf_len[k] = *len == ':' ? strtoul(len + 1, NULL, 10) : 0;
+        k++;
+    }
+
+    if (!configure_groups(k, n_ch, buf_len, err)) {
+        printf("Error: %s\n", err);
+        return;
+    }
+
+    printf("OK, groups = %u\n", n_groups);
+}
+
+// Print first channel, number of channels and buffer length of every group
+void get_groups_cmd() {
+    for (uint i = 0; i < n_groups; i++)
+        printf(
+            i + 1 < n_groups ? "%u:%u:%lu," : "%u:%u:%lu\n",
+            groups[i].first_ch,
+            groups[i].n_ch,
+            groups[i].buf_len
+        );
+}
+
+void set_group_cmd(char* next_token) {
+    char* tmp = strtok_r(NULL, " ", &next_token);
+    if (!tmp) {
+        printf("Error: group could not be parsed.\n");
+        return;
+    }
+
+    uint g = strtoul(tmp, NULL, 10);
+    if (g >= n_groups) {
+        printf("Error: group doesn't exist.\n");
+        return;
+    }
+    cur_group = g;
+    printf("ACK\n");
+}
+
+void get_group_cmd() { printf("%u\n", cur_group); }
+
+void set_sync_cmd(char* next_token) {
+    char* tmp = strtok_r(NULL, " ", &next_token);
+    if (!tmp) {
+        printf("Error: s parameter could not be parsed.\n");
+        return;
+    }
+
+    sync_start = atoi(tmp) != 0;
+    printf("ACK\n");
+}
+
+void get_sync_cmd() { printf("%d\n", sync_start ? 1 : 0); }
+
+void start_cmd() {
+    start_groups_in_sync();
+    printf("ACK\n");
+}
@@ -3,8 +3,75 @@
 #include "hardware/pio.h"
 #include "hardware/dma.h"
 
+// Max number of independent channel groups, each one needs its own state machine
+#define MAX_GROUPS 4
+
+// A group of consecutive output channels, driven by its own state machine and DMA channel
+// from its own region of pio_buf. Masks stored in the region are relative to first_ch.
+typedef struct {
+	uint sm;                     // State machine driving the channels
+	uint first_ch;               // First output channel of the group
+	uint n_ch;                   // Number of consecutive channels in the group
+	int dma;                     // DMA channel feeding the state machine
+	dma_channel_config dma_conf; // Config of the DMA channel
+	uint32_t* buf;               // Start of the group's region in pio_buf
+	uint32_t* entry_map;         // Entry boundaries of the region, part of pio_entry_map
+	uint32_t buf_len;            // Length of the region
+	const uint32_t* src;         // Where the DMA reads from, buf unless a flash image is played
+	uint dma_count;              // Number of transfers to be done by the DMA
+	uint32_t loop;               // Remaining repetitions, loop_inf_val for infinite
+	uint32_t pending;            // Repetitions waiting for a synchronized START
+	bool playlist;               // Set if the DMA is fed by the playlist instead of the whole sequence
+	uint32_t passes;             // Repetitions finished in the current run, only counted with EVENTS on
+	uint32_t seq_len;            // Length of a single copy of the sequence in words
+	uint32_t seq_entries;        // Number of source (time, mask) entries in the sequence
+	uint32_t seq_m;              // Number of copies in the region
+	uint32_t seq_m_target;       // Requested number of copies, 0 means fill the region
+} pulse_group_t;
+
+// Length of a single run of a ring DMA in transfers. A multiple of every ring length,
+// so the write address is back at the start of the ring whenever a run ends.
+#define RING_DMA_LEN (1u << 27)
+
+// A DMA channel moving data from a peripheral FIFO into a ring buffer, whose size in bytes has to be a power of two.
+// At the end of each run a second channel writes the transfer count of the first one back, which restarts it
+// without leaving a gap, so positions are continuous modulo RING_DMA_LEN.
+typedef struct {
+	int dma;                        // Channel moving the data
+	int reload;                     // Channel restarting the data channel
+	dma_channel_config conf;        // Config of the data channel
+	volatile void* ring;
+	const volatile void* src;
+	uint32_t ring_len;              // Ring length in transfers
+	uint32_t reload_count;          // Read by the reload channel
+} ring_dma_t;
+
 void init_pio(void);
 void init_dma(void);
-void start_dma(void);
+void init_group(pulse_group_t* g, uint first_ch, uint n_ch, uint32_t* buf, uint32_t buf_len);
+void reset_group_sequence(pulse_group_t* g);
+bool configure_groups(uint k, const uint* n_ch, const uint32_t* buf_len, char* err);
+uint group_of_channel(uint ch);
+uint32_t group_transfer_count(pulse_group_t* g);
+bool group_dma_busy(pulse_group_t* g);
+void start_dma(pulse_group_t* g);
+void start_groups_in_sync(void);
+void stop_group(pulse_group_t* g);
 void stop_all(void);
+uint32_t group_busy(pulse_group_t* g);
 uint32_t is_busy(void);
+
+void ring_dma_init(ring_dma_t* r, volatile void* ring, uint ring_bits, enum dma_channel_transfer_size size, const volatile void* src, uint dreq);
+void ring_dma_start(ring_dma_t* r);
+void ring_dma_stop(ring_dma_t* r);
+void ring_dma_release(ring_dma_t* r);
+uint32_t ring_dma_pos(ring_dma_t* r);
+uint32_t ring_dma_count_to_pos(uint32_t transfer_count);
+
+void set_groups_cmd(char* next_token);
+void get_groups_cmd(void);
+void set_group_cmd(char* next_token);
+void get_group_cmd(void);
+void set_sync_cmd(char* next_token);
+void get_sync_cmd(void);
+void start_cmd(void);
@@ -8,12 +8,17 @@
 #include "pico/stdlib.h"
 #include "hardware/clocks.h"
 #include "hardware/dma.h"
+#include "hardware/sync.h"
 
 #include "hardware.h"
 #include "command.h"
 #include "status.h"
 #include "rheostat.h"
 #include "laser.h"
+#include "counter.h"
+#include "boxcar.h"
+#include "transport.h"
+#include "events.h"
 
 // PIO parameters
 // Defined here for ease of access
@@ -23,21 +28,21 @@ const uint32_t pio_extra_cycles = 4;       // Number of cycles it takes the PIO
 #define PIO_BUF_LEN 65536                  // PIO instruction buffer length
 const uint32_t pio_buf_len = PIO_BUF_LEN;  // Save it to a constant as well for convenience
 uint32_t pio_buf[PIO_BUF_LEN];             // Buffer for storing data for the PIO
+uint32_t pio_entry_map[PIO_BUF_LEN / 32];  // Bitmap marking the first word of each sequence entry, used for patching
 
-// Pull in DMA related variables from hardware.c for use here
-extern int dma;          // Number of the DMA channel, used for checking if it's busy
-extern uint dma_count;   // Number of transfers to be done by the DMA, set after uploading new sequence
+// Pull in channel groups from hardware.c for use here. Each group has its own
+// DMA channel, transfer count and loop count, set after uploading new sequence.
+extern pulse_group_t groups[];
+extern uint n_groups;
 
 // Timing variables
 uint32_t cpu_clk;
 
-// Sequence looping control
-uint32_t loop = 0;                // Loop count
+// Sequence looping control, the loop count itself is stored per group
 const uint32_t loop_inf_val = ~0; // Max value of uint32_t, treated as inf
 
 // Pull in command processing flags from command.c
 extern bool cmd_ready;          // Indicate whether command ready to be processed
-extern bool rx_available;       // Indicate whether a character is avaialble on stdin
 
 
 int main() {
@@ -51,8 +56,8 @@ int main() {
     // Initialize serial communication on UART
     setup_default_uart();
 	stdio_init_all();
-    // Set up input handler
-    stdio_set_chars_available_callback(rx_handler, NULL);
+    // Set up command input on USB and UART
+    init_transports();
 
     // Initialize PIO and DMA channel
     init_pio();
@@ -72,7 +77,7 @@ int main() {
 		// If there are characters available, read one of them in.
 		// This might be slower than reading them in until the buffer is emtpy,
 		// but the DMA requires frequent attention and somewhat consistent timings
-		if (rx_available) {
+		if (transports_available()) {
 			cmd_read_char();
 		}
 
@@ -86,12 +91,28 @@ int main() {
 		}
 
 		// If DMA looping is requested and DMA is idle, restart it
-		if (loop != 0 && !dma_channel_is_busy(dma)) {
-			start_dma();
-			// If looping is finite, decrement counter
-			if (loop != loop_inf_val)
-				loop--;
+		for (uint i = 0; i < n_groups; i++) {
+			pulse_group_t* g = &groups[i];
+			if (g->loop != 0 && !group_dma_busy(g)) {
+				// A short run can complete before the counter is decremented, so the completion
+				// interrupt is held off until then, otherwise the last run would never report DONE
+				uint32_t irq = save_and_disable_interrupts();
+				start_dma(g);
+				// If looping is finite, decrement counter
+				if (g->loop != loop_inf_val)
+					g->loop--;
+				restore_interrupts(irq);
+			}
 		}
+
+		// Move finished gates of the photon counter into its histogram
+		counter_task();
+
+		// Sum the samples of finished boxcar windows
+		boxcar_task();
+
+		// Print queued events, if they are enabled
+		events_task();
 	}
 
 }
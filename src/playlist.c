@@ -0,0 +1,294 @@
+// Copyright (c) 2026 Bence Göblyös
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "pico/stdlib.h"
+#include "hardware/pio.h"
+#include "hardware/dma.h"
+
+#include "playlist.h"
+#include "hardware.h"
+#include "pulse.h"
+#include "counter.h"
+#include "boxcar.h"
+
+// Pull in PIO variables from hardware.c
+extern PIO pio;
+
+// Pull in channel groups from hardware.c
+extern pulse_group_t groups[];
+extern uint n_groups;
+extern uint cur_group;
+extern bool sync_start;
+
+// A playlist plays ranges of source entries of the group's sequence back-to-back, each a given number of times.
+// Every repetition of a range is a control block, which a control DMA channel loads into the alias 3 registers
+// of the group's DMA channel. The group's channel chains back to the control channel once it has sent the range,
+// so there is no gap between ranges. A null block at the end stops the chain, the main loop restarts the whole
+// list for the next pass the same way as a plain sequence.
+#define PLAYLIST_MAX_ENTRIES 32
+#define PLAYLIST_MAX_BLOCKS 1024
+
+typedef struct {
+	uint32_t first;      // First source entry of the range
+	uint32_t last;       // One past the last source entry
+	uint32_t reps;
+} playlist_entry_t;
+
+// Layout matches al3_transfer_count and al3_read_addr_trig
+typedef struct {
+	uint32_t count;
+	const uint32_t* read_addr;
+} playlist_block_t;
+
+playlist_entry_t playlist[PLAYLIST_MAX_ENTRIES];
+uint32_t playlist_len = 0;
+
+playlist_block_t playlist_blocks[PLAYLIST_MAX_BLOCKS + 1];
+uint8_t playlist_block_entry[PLAYLIST_MAX_BLOCKS];   // Playlist entry of each block
+uint32_t playlist_block_rep[PLAYLIST_MAX_BLOCKS];    // First repetition of the entry sent by each block
+uint32_t playlist_n_blocks = 0;
+uint32_t playlist_words = 0;                         // Words sent in a single pass
+
+int playlist_ctrl = -1;
+pulse_group_t* playlist_group = NULL;
+uint32_t playlist_starts = 0;                        // Passes started since the playlist was set
+
+// Address the control channel stops at, after reading the null block
+const playlist_block_t* playlist_end() {
+	return playlist_blocks + playlist_n_blocks + 1;
+}
+
+// Turn the entries into control blocks for the current sequence of the group
+bool build_playlist(pulse_group_t* g, char* err) {
+	uint32_t n = 0;
+
+	playlist_words = 0;
+	for (uint32_t e = 0; e < playlist_len; e++) {
+		uint32_t a = entry_offset(g, playlist[e].first);
+		uint32_t b = entry_offset(g, playlist[e].last);
+		// The copies of the whole sequence follow each other in the region,
+		// so a single block can send as many repetitions as there are copies
+		uint32_t per_block = (a == 0 && b == g->seq_len) ? g->seq_m : 1;
+
+		for (uint32_t r = 0; r < playlist[e].reps; r += per_block) {
+			if (n == PLAYLIST_MAX_BLOCKS) {
+				strcpy(err, "Playlist needs too many DMA blocks, reduce the repetitions!");
+				return false;
+			}
+			uint32_t reps = playlist[e].reps - r < per_block ? playlist[e].reps - r : per_block;
+			playlist_blocks[n].count = (b - a) * reps;
+			playlist_blocks[n].read_addr = g->buf + a;
+			playlist_block_entry[n] = e;
+			playlist_block_rep[n] = r;
+			n++;
+		}
+		playlist_words += (b - a) * playlist[e].reps;
+	}
+
+	// Null block, loading it doesn't trigger the channel
+	playlist_blocks[n].count = 0;
+	playlist_blocks[n].read_addr = NULL;
+	playlist_n_blocks = n;
+
+	// Park the control channel at the end, so the pass doesn't look like it's in progress
+	dma_channel_set_read_addr(playlist_ctrl, playlist_end(), false);
+	return true;
+}
+
+// Set up both channels for a pass without starting them, returns the channel to be started
+uint playlist_configure(pulse_group_t* g) {
+	dma_channel_config c = g->dma_conf;
+	channel_config_set_chain_to(&c, playlist_ctrl);
+	// Only the null block at the end of the pass raises the interrupt used by EVENTS
+	channel_config_set_irq_quiet(&c, true);
+	dma_channel_configure(g->dma, &c, &pio->txf[g->sm], NULL, 0, false);
+
+	c = dma_channel_get_default_config(playlist_ctrl);
+	channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+	channel_config_set_read_increment(&c, true);
+	// Write the two registers, wrapping back to the first one for the next block
+	channel_config_set_write_increment(&c, true);
+	channel_config_set_ring(&c, true, 3);
+	channel_config_set_high_priority(&c, true);
+	dma_channel_configure(
+		playlist_ctrl,
+		&c,
+		&dma_hw->ch[g->dma].al3_transfer_count,
+		playlist_blocks,
+		2,
+		false
+	);
+
+	playlist_starts++;
+	return playlist_ctrl;
+}
+
+// Either channel can be idle for a moment between blocks, so the pass is only over
+// once the control channel has read the null block
+bool playlist_busy(pulse_group_t* g) {
+	return dma_channel_is_busy(g->dma)
+		|| dma_channel_is_busy(playlist_ctrl)
+		|| dma_hw->ch[playlist_ctrl].read_addr != (uintptr_t)playlist_end();
+}
+
+// Called by stop_group with the completion interrupt masked. The group's channel stops chaining to the control channel
+// before both are aborted, so neither can retrigger the other, then the control channel is parked at the end.
+void stop_playlist(pulse_group_t* g) {
+	dma_channel_config c = g->dma_conf;
+	channel_config_set_chain_to(&c, g->dma);
+	channel_config_set_irq_quiet(&c, true);
+	dma_channel_set_config(g->dma, &c, false);
+	dma_channel_abort(playlist_ctrl);
+	dma_channel_abort(g->dma);
+	dma_channel_set_read_addr(playlist_ctrl, playlist_end(), false);
+}
+
+// Stop the group playing the playlist, if there's one
+void release_playlist() {
+	if (playlist_group && playlist_group->playlist) {
+		stop_group(playlist_group);
+		playlist_group->playlist = false;
+	}
+	playlist_group = NULL;
+}
+
+// PLAYLIST n i1:j1:r1 i2:j2:r2 ... or PLAYLIST OFF
+// Play entries [i, j) of the current group's sequence r times each, and repeat the whole list n times.
+// The entries are checked before anything is stopped, so an invalid command leaves the running playlist alone.
+void set_playlist_cmd(char* next_token) {
+	pulse_group_t* g = &groups[cur_group];
+	static char err[256];
+	static playlist_entry_t entries[PLAYLIST_MAX_ENTRIES];
+	char* tmp;
+	char* field;
+	char* next_field;
+	uint32_t n;
+	uint32_t len = 0;
+	uint32_t blocks = 0;
+
+	tmp = strtok_r(NULL, " ", &next_token);
+	if (!tmp) {
+		printf("Error: n parameter could not be parsed.\n");
+		return;
+	}
+
+	if (playlist_ctrl < 0)
+		playlist_ctrl = dma_claim_unused_channel(true);
+
+	if (!strcmp(tmp, "OFF")) {
+		release_playlist();
+		playlist_len = 0;
+		printf("ACK\n");
+		return;
+	}
+	n = strtoul(tmp, NULL, 10);
+
+	if (g->seq_len == 0) {
+		printf("Error: there is no sequence to play.\n");
+		return;
+	}
+
+	while ((tmp = strtok_r(NULL, " ", &next_token))) {
+		if (len == PLAYLIST_MAX_ENTRIES) {
+			printf("Error: Playlist can have at most %d entries!\n", PLAYLIST_MAX_ENTRIES);
+			return;
+		}
+
+		playlist_entry_t* e = &entries[len];
+		uint32_t* fields[3] = {&e->first, &e->last, &e->reps};
+		field = strtok_r(tmp, ":", &next_field);
+		for (uint i = 0; i < 3; i++) {
+			if (!field) {
+				printf("Error: Playlist entry %lu is invalid, use i:j:r!\n", len);
+				return;
+			}
+			*fields[i] = strtoul(field, NULL, 10);
+			field = strtok_r(NULL, ":", &next_field);
+		}
+
+		if (e->first >= e->last || e->last > g->seq_entries || e->reps == 0) {
+			printf("Error: Playlist entry %lu is invalid, the sequence has %lu entries.\n", len, g->seq_entries);
+			return;
+		}
+
+		// Same split as in build_playlist
+		uint32_t per_block = (entry_offset(g, e->first) == 0 && entry_offset(g, e->last) == g->seq_len) ? g->seq_m : 1;
+		blocks += (e->reps + per_block - 1) / per_block;
+		if (blocks > PLAYLIST_MAX_BLOCKS) {
+			printf("Error: Playlist needs too many DMA blocks, reduce the repetitions!\n");
+			return;
+		}
+		len++;
+	}
+
+	if (len == 0) {
+		printf("Error: Playlist is empty!\n");
+		return;
+	}
+
+	// Only one group can play a playlist at a time
+	release_playlist();
+	stop_group(g);
+
+	memcpy(playlist, entries, len * sizeof(playlist[0]));
+	playlist_len = len;
+	if (!build_playlist(g, err)) {
+		printf("Error: %s\n", err);
+		playlist_len = 0;
+		return;
+	}
+
+	g->playlist = true;
+	playlist_group = g;
+	playlist_starts = 0;
+
+	// With synchronized starts, the passes wait for START
+	if (sync_start)
+		g->pending = n;
+	else
+		g->loop = n;
+
+	// The counter and boxcar bins follow the copies of the sequence, not the playlist
+	clear_counter_group(g);
+	clear_boxcar_group(g);
+
+	printf("OK, entries = %lu, blocks = %lu, l_pass = %lu\n", playlist_len, playlist_n_blocks, playlist_words);
+}
+
+// PLAYLIST?
+// Group, current entry, its current repetition and the number of finished passes
+void get_playlist_cmd() {
+	pulse_group_t* g = playlist_group;
+
+	if (!g || !g->playlist) {
+		printf("-1,0,0,0\n");
+		return;
+	}
+
+	bool busy = playlist_busy(g);
+	uint32_t entry = playlist_len;
+	uint32_t rep = 0;
+
+	if (busy) {
+		// The control channel points past the block being sent
+		uint32_t block = (dma_hw->ch[playlist_ctrl].read_addr - (uintptr_t)playlist_blocks) / sizeof(playlist_block_t) - 1;
+		if (block < playlist_n_blocks) {
+			entry = playlist_block_entry[block];
+			rep = playlist_block_rep[block];
+			// Blocks covering several copies of the sequence
+			uint32_t remaining = dma_hw->ch[g->dma].transfer_count & 0x0FFFFFFF;
+			uint32_t sent = remaining < playlist_blocks[block].count ? playlist_blocks[block].count - remaining : 0;
+			uint32_t len = entry_offset(g, playlist[entry].last) - entry_offset(g, playlist[entry].first);
+			rep += sent / len;
+			// The next block might not have been loaded yet
+			if (rep >= playlist[entry].reps)
+				rep = playlist[entry].reps - 1;
+		}
+	}
+
+	printf("%u,%lu,%lu,%lu\n", (uint)(g - groups), entry, rep, playlist_starts - (busy ? 1 : 0));
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include "hardware.h"
+
+bool build_playlist(pulse_group_t* g, char* err);
+uint playlist_configure(pulse_group_t* g);
+bool playlist_busy(pulse_group_t* g);
+void stop_playlist(pulse_group_t* g);
+
+void set_playlist_cmd(char* next_token);
+void get_playlist_cmd(void);
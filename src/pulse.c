@@ -2,13 +2,26 @@
 #include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <math.h>
 
 #include "hardware.h"
 #include "pulse.h"
+#include "counter.h"
+#include "boxcar.h"
 
-#define PARSER_SUCCESS 0
-#define PARSER_EMPTY 1
-#define PARSER_FAILURE 2
+// Merge same-mask entries of PULSE, see optimize_entries
+bool optimize = false;
+
+// An entry read by read_merged_entry is waiting to be returned
+bool merge_held = false;
+
+// Max number of edge lists in a single EDGES command
+#define MAX_EDGE_LISTS 8
+
+// Scratch buffer for encoding patches before they are spliced into the sequence
+#define PATCH_BUF_LEN 1024
+uint32_t patch_buf[PATCH_BUF_LEN];
+uint32_t patch_map[PATCH_BUF_LEN / 32];
 
 // Primes for finding greatest common divisor
 #define GCD_PRIMES_LEN 2
@@ -23,12 +36,13 @@ extern const uint32_t pio_buf_len;
 extern const uint32_t pio_extra_cycles;
 extern const uint pio_n_gpio;
 
-// Pull in DMA variables from main.c
-extern uint32_t loop;
-extern int dma;
-extern uint dma_count;
+// Pull in channel groups from hardware.c
+extern pulse_group_t groups[];
+extern uint cur_group;
+extern bool sync_start;
 
 void decode_sequence(char* next_token, bool time_in_cycles) {
+	pulse_group_t* g = &groups[cur_group];
 	static char* tmp;
 	static char err[256];
 	static uint32_t m_target;
@@ -43,8 +57,8 @@ void decode_sequence(char* next_token, bool time_in_cycles) {
 	}
 	else {
 		printf("Error: m parameter could not be parsed.\n");
-		loop = 0;
-		dma_count = 0;
+		g->loop = 0;
+		reset_group_sequence(g);
 		return;
 	}
 
@@ -55,38 +69,153 @@ void decode_sequence(char* next_token, bool time_in_cycles) {
 	}
 	else {
 		printf("Error: n parameter could not be parsed.\n");
-		loop = 0;
-		dma_count = 0;
+		g->loop = 0;
+		reset_group_sequence(g);
 		return;
 	}
 
 	// If we don't intent to start immediately and the DMA is empty,
 	// we don't need to abort the current run
-	if (!(n == 0 && is_busy() != 2)) {
-		stop_all();
+	if (!(n == 0 && group_busy(g) != 2)) {
+		stop_group(g);
 	}
 	
-	bool keepgoing = true;
-	while(keepgoing) {
-		switch (parse_entry(&next_token, &i, err, time_in_cycles)) {
-		case PARSER_EMPTY:
-			keepgoing = false;
-			break;
-		case PARSER_FAILURE:
+	// Forget the entry boundaries of the previous sequence
+	memset(g->entry_map, 0, (g->buf_len / 32) * sizeof(g->entry_map[0]));
+	uint32_t entries = 0;
+	uint32_t entry_start;
+
+	uint32_t saved = 0;
+
+	if (optimize) {
+		if (optimize_entries(&next_token, g, &i, &entries, &saved, err, time_in_cycles) == PARSER_FAILURE) {
 			printf("Error: %s\n", err);
-			loop = 0;
-			dma_count = 0;
+			g->loop = 0;
+			reset_group_sequence(g);
 			return;
-		default:
-			break;
 		}
 	}
+	else {
+		bool keepgoing = true;
+		while(keepgoing) {
+			entry_start = i;
+			switch (parse_entry(&next_token, g, g->buf, g->buf_len, &i, err, time_in_cycles)) {
+			case PARSER_EMPTY:
+				keepgoing = false;
+				break;
+			case PARSER_FAILURE:
+				printf("Error: %s\n", err);
+				g->loop = 0;
+				reset_group_sequence(g);
+				return;
+			default:
+				// Mark the first word of the entry, so it can be found again when patching
+				map_put(g->entry_map, entry_start, true);
+				entries++;
+				break;
+			}
+		}
+	}
+
+	uint32_t m = finish_sequence(g, i, entries, m_target, n);
+
+	if (optimize)
+		printf("OK, m = %lu, n = %lu, l_seq = %lu, l_total = %lu, buf_util = %.2f, saved = %lu\n", m, n, i, m*i, (100.0*m*i)/g->buf_len, saved);
+	else
+		printf("OK, m = %lu, n = %lu, l_seq = %lu, l_total = %lu, buf_util = %.2f\n", m, n, i, m*i, (100.0*m*i)/g->buf_len);
+}
+
+// Peephole pass used by PULSE when OPTIMIZE is on. Consecutive entries with the same mask are merged,
+// then the merged entries are split again only where a single word can't hold them. Every entry is rounded
+// up to the shortest pulse before merging, so the total length is the same as without merging.
+// The number of words saved is put into *saved_ptr.
+uint32_t optimize_entries(char** next_token_ptr, pulse_group_t* g, uint32_t* i_ptr, uint32_t* entries_ptr, uint32_t* saved_ptr, char* err, bool time_in_cycles) {
+	static uint64_t time;
+	static uint64_t delay;
+	static uint32_t out;
+
+	uint32_t plain_len = 0;
+	uint32_t rc;
+
+	merge_held = false;
+	while ((rc = read_merged_entry(next_token_ptr, g, &time, &delay, &out, &plain_len, err, time_in_cycles)) == PARSER_SUCCESS) {
+		map_put(g->entry_map, *i_ptr, true);
+		if (encode_entry(delay, out, g->buf, g->buf_len, i_ptr, err) == PARSER_FAILURE)
+			return PARSER_FAILURE;
+		(*entries_ptr)++;
+	}
 
+	if (rc == PARSER_FAILURE)
+		return PARSER_FAILURE;
 
-	loop = n;
+	*saved_ptr = plain_len - *i_ptr;
+	return PARSER_SUCCESS;
+}
+
+// Read the next run of same-mask entries and merge it into one. *time_ptr is the summed requested time
+// and *delay_ptr the summed length in cycles, with every entry rounded up to the shortest pulse.
+// The words the entries would take up without merging are added to *plain_len_ptr.
+// The first entry of the next run is held back until the following call, callers clear merge_held
+// before reading the first entry.
+uint32_t read_merged_entry(char** next_token_ptr, pulse_group_t* g, uint64_t* time_ptr, uint64_t* delay_ptr, uint32_t* out_ptr, uint32_t* plain_len_ptr, char* err, bool time_in_cycles) {
+	static uint64_t held_time;
+	static uint64_t held_delay;
+	static uint32_t held_out;
+
+	uint32_t rc;
+	bool pending = false;
+
+	if (merge_held) {
+		*time_ptr = held_time;
+		*delay_ptr = held_delay;
+		*out_ptr = held_out;
+		pending = true;
+		merge_held = false;
+	}
+
+	while ((rc = read_entry(next_token_ptr, g, &held_time, &held_out, err)) == PARSER_SUCCESS) {
+		if (!time_to_cycles(held_time, &held_delay, err, time_in_cycles))
+			return PARSER_FAILURE;
+
+		// Count the words the entry would take up without merging
+		encode_entry(held_delay, held_out, NULL, ~(uint32_t)0, plain_len_ptr, err);
+
+		// Entries shorter than a word still take up the shortest pulse, as they do without merging
+		held_delay = held_delay > pio_extra_cycles ? held_delay : pio_extra_cycles;
+
+		if (!pending) {
+			*time_ptr = held_time;
+			*delay_ptr = held_delay;
+			*out_ptr = held_out;
+			pending = true;
+		}
+		else if (held_out == *out_ptr) {
+			*time_ptr += held_time;
+			*delay_ptr += held_delay;
+		}
+		else {
+			merge_held = true;
+			return PARSER_SUCCESS;
+		}
+	}
+
+	if (rc == PARSER_FAILURE)
+		return PARSER_FAILURE;
+
+	return pending ? PARSER_SUCCESS : PARSER_EMPTY;
+}
+
+// Fill the region of the group with copies of the freshly encoded sequence of length i
+// and set up its repetitions. Returns the number of copies.
+uint32_t finish_sequence(pulse_group_t* g, uint32_t i, uint32_t entries, uint32_t m_target, uint32_t n) {
+	// With synchronized starts, the repetitions wait for START
+	if (sync_start)
+		g->pending = n;
+	else
+		g->loop = n;
 
 	// Max number of inner loops that fit in the buffer
-	uint32_t m_max = pio_buf_len / i;
+	uint32_t m_max = g->buf_len / i;
 
 	// Set actual number of inner loops
 	uint32_t m;
@@ -98,34 +227,522 @@ void decode_sequence(char* next_token, bool time_in_cycles) {
 	// Copy contents inside the buffer
 	for (uint32_t j = 1; j < m; j++)
 		memcpy(
-			pio_buf + (i * j),
-			pio_buf,
-			i * sizeof(pio_buf[0])
+			g->buf + (i * j),
+			g->buf,
+			i * sizeof(g->buf[0])
 		);
 
-	dma_count = i*m;
-	printf("OK, m = %lu, n = %lu, l_seq = %lu, l_total = %lu, buf_util = %.2f\n", m, n, i, m*i, (100.0*m*i)/pio_buf_len);
+	g->seq_len = i;
+	g->seq_entries = entries;
+	g->seq_m = m;
+	g->seq_m_target = m_target;
+
+	g->src = g->buf;
+	// A playlist refers to entries of the previous sequence
+	g->playlist = false;
+	g->dma_count = i*m;
+
+	// Gates might have moved, so the counter histogram and boxcar windows are no longer valid if they come from this group
+	clear_counter_group(g);
+	clear_boxcar_group(g);
+
+	return m;
 }
 
-uint32_t parse_entry(char** next_token_ptr, uint32_t* i_ptr, char* err, bool time_in_cycles) {
+// EDGES m n T ch:t1,t2,... ch:t1,t2,...
+// Each channel starts low and toggles at the given absolute times. The edge lists are merged
+// into (duration, mask) segments, which are encoded the same way as the entries of PULSE.
+void decode_edges(char* next_token, bool time_in_cycles) {
+	pulse_group_t* g = &groups[cur_group];
 	static char* tmp;
+	static char err[256];
+	static uint32_t m_target;
+	static uint32_t n;
+	static uint64_t period;
+	static char* edge_lists[MAX_EDGE_LISTS];
+	static uint edge_ch[MAX_EDGE_LISTS];
+	static uint64_t edge_next[MAX_EDGE_LISTS];
+
+	uint32_t i = 0;
+	uint k = 0;
+
+	// Read in m, n and the period
+	tmp = strtok_r(NULL, " ", &next_token);
+	if (!tmp) {
+		printf("Error: m parameter could not be parsed.\n");
+		return;
+	}
+	m_target = strtoul(tmp, NULL, 10);
+
+	tmp = strtok_r(NULL, " ", &next_token);
+	if (!tmp) {
+		printf("Error: n parameter could not be parsed.\n");
+		return;
+	}
+	n = strtoul(tmp, NULL, 10);
+
+	tmp = strtok_r(NULL, " ", &next_token);
+	if (!tmp) {
+		printf("Error: T parameter could not be parsed.\n");
+		return;
+	}
+	if (!time_to_cycles(strtoull(tmp, NULL, 10), &period, err, time_in_cycles)) {
+		printf("Error: %s\n", err);
+		return;
+	}
+
+	// Collect the edge list of each channel before tokenizing them
+	while ((tmp = strtok_r(NULL, " ", &next_token))) {
+		char* list;
+		if (k == MAX_EDGE_LISTS) {
+			printf("Error: too many edge lists.\n");
+			return;
+		}
+		edge_ch[k] = strtoul(tmp, &list, 10);
+		if (*list != ':' || edge_ch[k] >= pio_n_gpio) {
+			printf("Error: edge list must start with a valid channel number and a colon.\n");
+			return;
+		}
+		if (edge_ch[k] < g->first_ch || edge_ch[k] >= g->first_ch + g->n_ch) {
+			printf("Error: channel %u is outside of the selected group!\n", edge_ch[k]);
+			return;
+		}
+		edge_lists[k] = list + 1;
+		k++;
+	}
+
+	if (period == 0) {
+		printf("Error: period must be longer than zero.\n");
+		return;
+	}
+
+	if (!(n == 0 && group_busy(g) != 2)) {
+		stop_group(g);
+	}
+
+	memset(g->entry_map, 0, (g->buf_len / 32) * sizeof(g->entry_map[0]));
+	uint32_t entries = 0;
+
+	// Load the first edge of each channel
+	for (uint j = 0; j < k; j++)
+		if (!next_edge(&edge_lists[j], &edge_next[j], 0, err, time_in_cycles)) {
+			printf("Error: %s\n", err);
+			g->loop = 0;
+			reset_group_sequence(g);
+			return;
+		}
+
+	// k-way merge. Edges closer than a cycle collapse into a single transition,
+	// and segments that end up with the same mask are joined.
+	uint64_t now = 0;
+	uint64_t seg_start = 0;
+	uint32_t mask = 0;
+	uint32_t seg_mask = 0;
+	uint64_t next;
+
+	while (true) {
+		next = period;
+		for (uint j = 0; j < k; j++)
+			next = edge_next[j] < next ? edge_next[j] : next;
+
+		if (next > now) {
+			// The state between now and next is final, emit the previous segment if the mask changed
+			if (mask != seg_mask && now > seg_start) {
+				map_put(g->entry_map, i, true);
+				if (encode_entry(now - seg_start, seg_mask >> g->first_ch, g->buf, g->buf_len, &i, err) == PARSER_FAILURE) {
+					printf("Error: %s\n", err);
+					g->loop = 0;
+					reset_group_sequence(g);
+					return;
+				}
+				entries++;
+				seg_start = now;
+			}
+			seg_mask = mask;
+			now = next;
+		}
+
+		if (next >= period)
+			break;
+
+		// Apply every edge at this time
+		for (uint j = 0; j < k; j++)
+			if (edge_next[j] == next) {
+				mask ^= 1u << edge_ch[j];
+				if (!next_edge(&edge_lists[j], &edge_next[j], next, err, time_in_cycles)) {
+					printf("Error: %s\n", err);
+					g->loop = 0;
+					reset_group_sequence(g);
+					return;
+				}
+			}
+	}
+
+	// Last segment runs until the end of the period
+	map_put(g->entry_map, i, true);
+	if (encode_entry(period - seg_start, seg_mask >> g->first_ch, g->buf, g->buf_len, &i, err) == PARSER_FAILURE) {
+		printf("Error: %s\n", err);
+		g->loop = 0;
+		reset_group_sequence(g);
+		return;
+	}
+	entries++;
+
+	uint32_t m = finish_sequence(g, i, entries, m_target, n);
+	printf("OK, m = %lu, n = %lu, l_seq = %lu, l_total = %lu, buf_util = %.2f\n", m, n, i, m*i, (100.0*m*i)/g->buf_len);
+}
+
+// Read the next edge of a channel, in cycles. Returns ~0 once the list is exhausted.
+bool next_edge(char** list_ptr, uint64_t* edge_ptr, uint64_t prev, char* err, bool time_in_cycles) {
+	char* tmp = strtok_r(NULL, ",", list_ptr);
+	if (!tmp) {
+		*edge_ptr = ~(uint64_t)0;
+		return true;
+	}
+
+	if (!time_to_cycles(strtoull(tmp, NULL, 10), edge_ptr, err, time_in_cycles))
+		return false;
+
+	if (*edge_ptr < prev) {
+		strcpy(err, "Edges must be in ascending order!");
+		return false;
+	}
+
+	return true;
+}
+
+// PULSE:CHECK m t1,p1,t2,p2,...
+// Runs the encoder without writing to the buffer and reports the resulting timings and buffer usage.
+// The output and the buffered sequence are left alone.
+void check_sequence(char* next_token, bool time_in_cycles) {
+	pulse_group_t* g = &groups[cur_group];
+	static char* tmp;
+	static char err[256];
+	static uint32_t m_target;
+	static uint64_t time;
+	static uint32_t out;
+	static uint64_t delay;
+	static const double s_to_ns = 1e9;
+
+	uint32_t i = 0;
+	uint32_t entries = 0;
+	uint32_t plain_len = 0;
+	uint64_t total_cycles = 0;
+	double total_ns = 0;
+	double err_ns;
+	double max_err_ns = 0;
+	double total_err_ns = 0;
+	uint32_t rc;
+
+	// Read in m
+	tmp = strtok_r(NULL, " ", &next_token);
+	if (!tmp) {
+		printf("Error: m parameter could not be parsed.\n");
+		return;
+	}
+	m_target = strtoul(tmp, NULL, 10);
+
+	// The list is read twice, first for the summary, then for the cycles of each entry,
+	// which are printed at the end of the same line. Nothing has to be stored per entry.
+	char* list = next_token;
+	size_t list_len = list ? strlen(list) : 0;
+
+	merge_held = false;
+	while ((rc = check_entry(&next_token, g, &time, &delay, &out, &plain_len, err, time_in_cycles)) == PARSER_SUCCESS) {
+		// Keep counting past the end of the buffer, so the report says how many words are needed
+		encode_entry(delay, out, NULL, ~(uint32_t)0, &i, err);
+
+		// Rounding error compared to the requested time, positive if the entry got longer
+		if (time_in_cycles)
+			err_ns = ((double)delay - (double)time) * s_to_ns / cpu_clk;
+		else
+			err_ns = (double)delay * s_to_ns / cpu_clk - (double)time;
+
+		entries++;
+		total_cycles += delay;
+		total_err_ns += err_ns;
+		max_err_ns = fabs(err_ns) > max_err_ns ? fabs(err_ns) : max_err_ns;
+	}
+
+	if (rc == PARSER_FAILURE) {
+		printf("Error in entry %lu: %s\n", entries, err);
+		return;
+	}
+
+	if (i == 0) {
+		printf("Error: sequence is empty.\n");
+		return;
+	}
+
+	total_ns = (double)total_cycles * s_to_ns / cpu_clk;
+
+	// Same as in finish_sequence, a sequence that doesn't fit gets m = 0
+	uint32_t m_max = g->buf_len / i;
+	uint32_t m;
+	if (m_target == 0)
+		m = m_max;
+	else
+		m = m_target < m_max ? m_target : m_max;
+
+	printf(
+		"OK, fits = %d, m = %lu, l_seq = %lu, l_total = %lu, buf_util = %.2f, split_words = %lu, total_cycles = %llu, total_ns = %.3f, max_err_ns = %.3f, total_err_ns = %.3f",
+		i <= g->buf_len, m, i, m*i, (100.0*m*i)/g->buf_len, i - entries, total_cycles, total_ns, max_err_ns, total_err_ns
+	);
+	if (optimize)
+		printf(", saved = %lu", plain_len - i);
+
+	// strtok_r cut the list at every comma, put them back for the second pass
+	for (size_t j = 0; j < list_len; j++)
+		if (list[j] == '\0')
+			list[j] = ',';
+	next_token = list;
+
+	printf(", cycles = ");
+	merge_held = false;
+	for (uint32_t j = 0; check_entry(&next_token, g, &time, &delay, &out, &plain_len, err, time_in_cycles) == PARSER_SUCCESS; j++)
+		printf(j == 0 ? "%llu" : ",%llu", delay);
+	printf("\n");
+}
+
+// Read the next entry of PULSE:CHECK, merged the same way as PULSE would if OPTIMIZE is on,
+// so the entries match what PATCH sees. *delay_ptr is rounded up to the shortest pulse.
+uint32_t check_entry(char** next_token_ptr, pulse_group_t* g, uint64_t* time_ptr, uint64_t* delay_ptr, uint32_t* out_ptr, uint32_t* plain_len_ptr, char* err, bool time_in_cycles) {
+	uint32_t rc;
+
+	if (optimize)
+		return read_merged_entry(next_token_ptr, g, time_ptr, delay_ptr, out_ptr, plain_len_ptr, err, time_in_cycles);
+
+	rc = read_entry(next_token_ptr, g, time_ptr, out_ptr, err);
+	if (rc != PARSER_SUCCESS)
+		return rc;
+	if (!time_to_cycles(*time_ptr, delay_ptr, err, time_in_cycles))
+		return PARSER_FAILURE;
+
+	// Splitting keeps the length exact, only the rounding up of short entries changes it
+	*delay_ptr = *delay_ptr > pio_extra_cycles ? *delay_ptr : pio_extra_cycles;
+	return PARSER_SUCCESS;
+}
+
+void patch_sequence(char* next_token, bool time_in_cycles) {
+	pulse_group_t* g = &groups[cur_group];
+	static char* tmp;
+	static char err[256];
+	static uint32_t first;
+	static uint32_t last;
+
+	uint32_t k = 0;
+
+	// Read in index of the first entry to be replaced
+	tmp = strtok_r(NULL, " ", &next_token);
+	if (tmp) {
+		first = strtoul(tmp, NULL, 10);
+	}
+	else {
+		printf("Error: i parameter could not be parsed.\n");
+		return;
+	}
+
+	// Read in index one past the last entry to be replaced
+	tmp = strtok_r(NULL, " ", &next_token);
+	if (tmp) {
+		last = strtoul(tmp, NULL, 10);
+	}
+	else {
+		printf("Error: j parameter could not be parsed.\n");
+		return;
+	}
+
+	if (g->seq_len == 0) {
+		printf("Error: there is no sequence to patch.\n");
+		return;
+	}
+
+	if (first > last || last > g->seq_entries) {
+		printf("Error: entry range is invalid, the sequence has %lu entries.\n", g->seq_entries);
+		return;
+	}
+
+	// Encode the new entries into the scratch buffer first, so a parsing error leaves the sequence intact
+	memset(patch_map, 0, sizeof(patch_map));
+	uint32_t entries = 0;
+	uint32_t entry_start;
+
+	bool keepgoing = true;
+	while(keepgoing) {
+		entry_start = k;
+		switch (parse_entry(&next_token, g, patch_buf, PATCH_BUF_LEN, &k, err, time_in_cycles)) {
+		case PARSER_EMPTY:
+			keepgoing = false;
+			break;
+		case PARSER_FAILURE:
+			printf("Error: %s\n", err);
+			return;
+		default:
+			map_put(patch_map, entry_start, true);
+			entries++;
+			break;
+		}
+	}
+
+	// Word range [a, b) covered by the replaced entries
+	uint32_t a = entry_offset(g, first);
+	uint32_t b = entry_offset(g, last);
+	uint32_t new_len = g->seq_len - (b - a) + k;
+
+	if (new_len == 0) {
+		printf("Error: patch would leave the sequence empty.\n");
+		return;
+	}
+
+	// Number of copies that fit with the new length
+	uint32_t m_max = g->buf_len / new_len;
+	uint32_t m;
+	if (g->seq_m_target == 0)
+		m = m_max;
+	else
+		m = g->seq_m_target < m_max ? g->seq_m_target : m_max;
+
+	if (m == 0) {
+		printf("Error: Insertion failed, buffer has been overrun.\n");
+		return;
+	}
+
+	// The playlist refers to the entries by index and to the copies by address
+	if (g->playlist && (k != b - a || entries != last - first)) {
+		printf("Error: a playlist is using the sequence, only patches keeping its layout are allowed.\n");
+		return;
+	}
+
+	// Changing the gate or window channel moves the bins, which can only be restarted with the output stopped
+	uint32_t gates = counter_gate_mask(g) | boxcar_window_mask(g);
+	bool moves_gates = false;
+	for (uint32_t j = 0; j < k && k == b - a; j++)
+		moves_gates |= ((g->buf[a + j] ^ patch_buf[j]) & gates) != 0;
+
+	if (k == b - a && m == g->seq_m && !moves_gates) {
+		// The encoded size didn't change, so every copy can be updated in place
+		// without moving anything else. This doesn't interrupt the output.
+		for (uint32_t j = 0; j < m; j++)
+			memcpy(
+				g->buf + (g->seq_len * j) + a,
+				patch_buf,
+				k * sizeof(g->buf[0])
+			);
+	}
+	else {
+		// The layout of the buffer changes, so the DMA can't keep reading it.
+		// Remaining repetitions continue with the patched sequence, the interrupted one is dropped.
+		uint32_t n = g->loop;
+		uint32_t pending = g->pending;
+		stop_group(g);
+
+		// Move the tail of the first copy into place and insert the patch
+		memmove(
+			g->buf + a + k,
+			g->buf + b,
+			(g->seq_len - b) * sizeof(g->buf[0])
+		);
+		memcpy(g->buf + a, patch_buf, k * sizeof(g->buf[0]));
+
+		// Shift entry boundaries of the tail along with it
+		if (a + k > b)
+			for (uint32_t j = g->seq_len - b; j-- > 0;)
+				map_put(g->entry_map, a + k + j, map_get(g->entry_map, b + j));
+		else
+			for (uint32_t j = 0; j < g->seq_len - b; j++)
+				map_put(g->entry_map, a + k + j, map_get(g->entry_map, b + j));
+
+		// Clear boundaries left behind by a shrinking sequence
+		for (uint32_t j = new_len; j < g->seq_len; j++)
+			map_put(g->entry_map, j, false);
+
+		// Redo the copies, as all of them have moved
+		for (uint32_t j = 1; j < m; j++)
+			memcpy(
+				g->buf + (new_len * j),
+				g->buf,
+				new_len * sizeof(g->buf[0])
+			);
+
+		g->seq_len = new_len;
+		g->seq_m = m;
+		g->dma_count = new_len * m;
+		clear_counter_group(g);
+		clear_boxcar_group(g);
+		g->loop = n;
+		g->pending = pending;
+	}
+
+	// Entry boundaries of the patch itself
+	for (uint32_t j = 0; j < k; j++)
+		map_put(g->entry_map, a + j, map_get(patch_map, j));
+
+	g->seq_entries = g->seq_entries - (last - first) + entries;
+
+	printf("OK, m = %lu, l_seq = %lu, l_total = %lu, buf_util = %.2f\n", g->seq_m, g->seq_len, g->seq_m*g->seq_len, (100.0*g->seq_m*g->seq_len)/g->buf_len);
+}
+
+// Find the word offset of the given source entry in the first copy of the sequence
+uint32_t entry_offset(pulse_group_t* g, uint32_t index) {
+	uint32_t remaining = index;
+	uint32_t bits;
+	uint32_t count;
+
+	for (uint32_t w = 0; w < (g->seq_len + 31) / 32; w++) {
+		bits = g->entry_map[w];
+		count = __builtin_popcount(bits);
+		if (remaining < count) {
+			// Clear the lowest set bits until the requested one is the lowest
+			while (remaining--)
+				bits &= bits - 1;
+			return 32 * w + __builtin_ctz(bits);
+		}
+		remaining -= count;
+	}
+
+	// One past the last entry
+	return g->seq_len;
+}
+
+bool map_get(const uint32_t* map, uint32_t i) {
+	return (map[i / 32] >> (i % 32)) & 1;
+}
+
+void map_put(uint32_t* map, uint32_t i, bool val) {
+	if (val)
+		map[i / 32] |= 1u << (i % 32);
+	else
+		map[i / 32] &= ~(1u << (i % 32));
+}
+
+uint32_t parse_entry(char** next_token_ptr, pulse_group_t* g, uint32_t* buf, uint32_t buf_len, uint32_t* i_ptr, char* err, bool time_in_cycles) {
 	static uint32_t out;
 	static uint64_t time;
 	static uint64_t delay;
-	static uint64_t simplify;
-	static const uint64_t s_to_ns = 1000000000;
-	static uint32_t full_pulses;
-	static uint32_t remainder;
-	static bool rem_correction;
-	static uint32_t temp_delay;
-	uint64_t max_cycles = (1 << (32 - pio_n_gpio)) - 1 + pio_extra_cycles;
+	static uint32_t rc;
+
+	rc = read_entry(next_token_ptr, g, &time, &out, err);
+	if (rc != PARSER_SUCCESS)
+		return rc;
+
+	if (!time_to_cycles(time, &delay, err, time_in_cycles))
+		return PARSER_FAILURE;
+
+	return encode_entry(delay, out, buf, buf_len, i_ptr, err);
+}
+
+// Read the next (time, mask) pair from the parameter list. The mask is
+// validated and converted to be relative to the first channel of the group.
+uint32_t read_entry(char** next_token_ptr, pulse_group_t* g, uint64_t* time_ptr, uint32_t* out_ptr, char* err) {
+	static char* tmp;
+	static uint32_t out;
 
 	// Read time from parameter list
 	tmp = strtok_r(NULL, ",", next_token_ptr);
 	if (!tmp)
 		return PARSER_EMPTY;
 
-	time = strtoull(tmp, NULL, 10);
+	*time_ptr = strtoull(tmp, NULL, 10);
 
 	tmp = strtok_r(NULL, ",", next_token_ptr);
 	if (!tmp) {
@@ -139,8 +756,23 @@ uint32_t parse_entry(char** next_token_ptr, uint32_t* i_ptr, char* err, bool tim
 		return PARSER_FAILURE;
 	}
 
+	// Masks are given for all channels, but stored relative to the first channel of the group
+	if (out & ~(((1 << g->n_ch) - 1) << g->first_ch)) {
+		strcpy(err, "Output mask contains channels outside of the selected group!");
+		return PARSER_FAILURE;
+	}
+	*out_ptr = out >> g->first_ch;
+
+	return PARSER_SUCCESS;
+}
+
+// Convert a time in nanoseconds to clock cycles, rounding down
+bool time_to_cycles(uint64_t time, uint64_t* delay_ptr, char* err, bool time_in_cycles) {
+	static uint64_t simplify;
+	static const uint64_t s_to_ns = 1000000000;
+
 	if (time_in_cycles) {
-		delay = time;
+		*delay_ptr = time;
 	}
 	else {
 		// Find simplification factor for cpu_clk/s_to_ns. As these are all large, likely round numbers,
@@ -149,11 +781,24 @@ uint32_t parse_entry(char** next_token_ptr, uint32_t* i_ptr, char* err, bool tim
 		// If time * (cpu_clk / simplify) would cause an overflow, abort
 		if (time > (~(uint64_t)0 / (cpu_clk / simplify))) {
 			strcpy(err, "Time is too long to process! Consider using cycle timings instead.");
-			return PARSER_FAILURE;
+			return false;
 		}
-		delay = time * (cpu_clk / simplify) / (s_to_ns / simplify); // Convert ns to cycles
+		*delay_ptr = time * (cpu_clk / simplify) / (s_to_ns / simplify); // Convert ns to cycles
 	}
 
+	return true;
+}
+
+// Encode a single (delay, mask) segment into the buffer starting at *i_ptr,
+// splitting it into several words if it's longer than a single word can hold.
+// If buf is NULL, the words are only counted.
+uint32_t encode_entry(uint64_t delay, uint32_t out, uint32_t* buf, uint32_t buf_len, uint32_t* i_ptr, char* err) {
+	static uint32_t full_pulses;
+	static uint32_t remainder;
+	static bool rem_correction;
+	static uint32_t temp_delay;
+	uint64_t max_cycles = (1 << (32 - pio_n_gpio)) - 1 + pio_extra_cycles;
+
 	// If the delay is too short, round it up to the shortest possible value
 	delay = delay > pio_extra_cycles ? delay : pio_extra_cycles;
 
@@ -175,7 +820,7 @@ uint32_t parse_entry(char** next_token_ptr, uint32_t* i_ptr, char* err, bool tim
 			else
 				temp_delay = max_cycles;
 
-			if (!attempt_insertion(temp_delay, out, (*i_ptr)++)) {
+			if (!attempt_insertion(temp_delay, out, buf, buf_len, (*i_ptr)++)) {
 				strcpy(err, "Insertion failed, buffer has been overrun.");
 				return PARSER_FAILURE;
 			}
@@ -188,7 +833,7 @@ uint32_t parse_entry(char** next_token_ptr, uint32_t* i_ptr, char* err, bool tim
 		else
 			temp_delay = remainder;
 
-		if (!attempt_insertion(temp_delay, out, (*i_ptr)++)) {
+		if (!attempt_insertion(temp_delay, out, buf, buf_len, (*i_ptr)++)) {
 			strcpy(err, "Insertion failed, buffer has been overrun.");
 			return PARSER_FAILURE;
 		}
@@ -198,10 +843,10 @@ uint32_t parse_entry(char** next_token_ptr, uint32_t* i_ptr, char* err, bool tim
 
 }
 
-bool attempt_insertion(uint32_t delay, uint32_t output, uint32_t i) {
+bool attempt_insertion(uint32_t delay, uint32_t output, uint32_t* buf, uint32_t buf_len, uint32_t i) {
 	static uint32_t val;
 
-	if (i >= pio_buf_len)
+	if (i >= buf_len)
 		return false;
 
 	// Round up delay to at least pio_extra_cycles
@@ -210,23 +855,25 @@ bool attempt_insertion(uint32_t delay, uint32_t output, uint32_t i) {
 	// Calculate PIO command value
 	val = ((delay - pio_extra_cycles) << pio_n_gpio) | output;
 
-	pio_buf[i] = val;
+	// Dry runs only count the words
+	if (buf)
+		buf[i] = val;
 	return true;
 }
 
-uint64_t gcd(uint64_t a, uint64_t b) {
-	// Cache previous entry, as this function is expected to be called
-	// multiple times with the same arguments
-	static uint64_t a_cache = 0;
-	static uint64_t b_cache = 0;
-	static uint64_t r_cache = 1;
+// Cache previous entry of gcd(), as it is expected to be called
+// multiple times with the same arguments
+uint64_t gcd_a_cache = 0;
+uint64_t gcd_b_cache = 0;
+uint64_t gcd_r_cache = 1;
 
+uint64_t gcd(uint64_t a, uint64_t b) {
 	// Return cached result if possible
-	if (a == a_cache && b == b_cache) {
-		return r_cache;
+	if (a == gcd_a_cache && b == gcd_b_cache) {
+		return gcd_r_cache;
 	} else {
-		a_cache = a;
-		b_cache = b;
+		gcd_a_cache = a;
+		gcd_b_cache = b;
 	}
 
 	uint64_t r = 1;
@@ -244,6 +891,26 @@ uint64_t gcd(uint64_t a, uint64_t b) {
 		}
 	}
 
-	r_cache = r;
+	gcd_r_cache = r;
 	return r;
 }
+
+// Forget the cached gcd() result, called when the clock speed changes
+void gcd_clear_cache() {
+	gcd_a_cache = 0;
+	gcd_b_cache = 0;
+	gcd_r_cache = 1;
+}
+
+void set_optimize_cmd(char* next_token) {
+	char* tmp = strtok_r(NULL, " ", &next_token);
+	if (!tmp) {
+		printf("Error: s parameter could not be parsed.\n");
+		return;
+	}
+
+	optimize = atoi(tmp) != 0;
+	printf("ACK\n");
+}
+
+void get_optimize_cmd() { printf("%d\n", optimize ? 1 : 0); }
@@ -1,6 +1,29 @@
 #pragma once
 
+#include "hardware.h"
+
+#define PARSER_SUCCESS 0
+#define PARSER_EMPTY 1
+#define PARSER_FAILURE 2
+
 void decode_sequence(char* next_token, bool time_in_cycles);
-uint32_t parse_entry(char** next_token_ptr, uint32_t* i_ptr, char* err, bool time_in_cycles);
-bool attempt_insertion(uint32_t delay, uint32_t output, uint32_t i);
+uint32_t optimize_entries(char** next_token_ptr, pulse_group_t* g, uint32_t* i_ptr, uint32_t* entries_ptr, uint32_t* saved_ptr, char* err, bool time_in_cycles);
+uint32_t read_merged_entry(char** next_token_ptr, pulse_group_t* g, uint64_t* time_ptr, uint64_t* delay_ptr, uint32_t* out_ptr, uint32_t* plain_len_ptr, char* err, bool time_in_cycles);
+uint32_t finish_sequence(pulse_group_t* g, uint32_t i, uint32_t entries, uint32_t m_target, uint32_t n);
+void decode_edges(char* next_token, bool time_in_cycles);
+bool next_edge(char** list_ptr, uint64_t* edge_ptr, uint64_t prev, char* err, bool time_in_cycles);
+void check_sequence(char* next_token, bool time_in_cycles);
+uint32_t check_entry(char** next_token_ptr, pulse_group_t* g, uint64_t* time_ptr, uint64_t* delay_ptr, uint32_t* out_ptr, uint32_t* plain_len_ptr, char* err, bool time_in_cycles);
+void patch_sequence(char* next_token, bool time_in_cycles);
+uint32_t entry_offset(pulse_group_t* g, uint32_t index);
+bool map_get(const uint32_t* map, uint32_t i);
+void map_put(uint32_t* map, uint32_t i, bool val);
+uint32_t parse_entry(char** next_token_ptr, pulse_group_t* g, uint32_t* buf, uint32_t buf_len, uint32_t* i_ptr, char* err, bool time_in_cycles);
+uint32_t read_entry(char** next_token_ptr, pulse_group_t* g, uint64_t* time_ptr, uint32_t* out_ptr, char* err);
+bool time_to_cycles(uint64_t time, uint64_t* delay_ptr, char* err, bool time_in_cycles);
+uint32_t encode_entry(uint64_t delay, uint32_t out, uint32_t* buf, uint32_t buf_len, uint32_t* i_ptr, char* err);
+bool attempt_insertion(uint32_t delay, uint32_t output, uint32_t* buf, uint32_t buf_len, uint32_t i);
 uint64_t gcd(uint64_t a, uint64_t b);
+void gcd_clear_cache(void);
+void set_optimize_cmd(char* next_token);
+void get_optimize_cmd(void);
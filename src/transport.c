@@ -0,0 +1,75 @@
+// Copyright (c) 2026 Bence Göblyös
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include <stdio.h>
+
+#include "pico/stdlib.h"
+#include "pico/stdio_usb.h"
+
+#include "transport.h"
+
+// Every transport the command engine polls, in order of priority
+transport_t* transports[N_TRANSPORTS] = {
+	&transport_usb,
+	&transport_uart,
+	&transport_loopback,
+};
+
+void init_transports() {
+	for (uint i = 0; i < N_TRANSPORTS; i++)
+		if (transports[i]->init)
+			transports[i]->init();
+}
+
+// Check whether any of the active transports has data waiting
+bool transports_available() {
+	for (uint i = 0; i < N_TRANSPORTS; i++)
+		if (transports[i]->active && transports[i]->available())
+			return true;
+	return false;
+}
+
+// First active transport with data waiting, or NULL
+transport_t* next_transport() {
+	for (uint i = 0; i < N_TRANSPORTS; i++)
+		if (transports[i]->active && transports[i]->available())
+			return transports[i];
+	return NULL;
+}
+
+// USB CDC transport. Characters are read through the stdio driver directly,
+// so the UART stdio driver doesn't compete with the UART DMA for incoming data.
+
+bool usb_rx_available = false;  // Indicate whether a character is avaialble on USB
+
+// This function is set as the callback when chars are available on USB
+void usb_rx_handler(void* ptr) {
+	usb_rx_available = true;
+}
+
+void usb_init() {
+	// Only set for the USB driver, the UART receive interrupt would fight the DMA otherwise
+	stdio_usb.set_chars_available_callback(usb_rx_handler, NULL);
+}
+
+bool usb_available() {
+	return usb_rx_available;
+}
+
+int usb_read_char() {
+	char c;
+	if (stdio_usb.in_chars(&c, 1) == 1)
+		return (unsigned char)c;
+
+	// If we couldn't get a character, indicate that the buffer is empty
+	usb_rx_available = false;
+	return PICO_ERROR_NO_DATA;
+}
+
+transport_t transport_usb = {
+	.name = "USB",
+	.init = usb_init,
+	.available = usb_available,
+	.read_char = usb_read_char,
+	.active = true,
+};
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "pico/stdlib.h"
+
+// A byte stream that commands are received from. Responses are sent through
+// stdio, which is routed to every transport that can send data.
+typedef struct {
+	const char* name;
+	void (*init)(void);
+	bool (*available)(void);   // Cheap check whether read_char has data
+	int (*read_char)(void);    // Next character, PICO_ERROR_NO_DATA if there's none or PICO_ERROR_IO if characters were lost
+	bool active;
+} transport_t;
+
+#define N_TRANSPORTS 3
+
+void init_transports(void);
+bool transports_available(void);
+transport_t* next_transport(void);
+
+// USB CDC, transport.c
+extern transport_t transport_usb;
+
+// UART with DMA receive, transport_uart.c
+extern transport_t transport_uart;
+
+// In-memory loopback for tests, transport_loopback.c
+extern transport_t transport_loopback;
+void loopback_enable(bool enabled);
+uint32_t loopback_write(const char* buf, uint32_t len);
+uint32_t loopback_read(char* buf, uint32_t len);
+void loopback_cmd(char* next_token);
@@ -0,0 +1,154 @@
+// Copyright (c) 2026 Bence Göblyös
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include <stdio.h>
+#include <string.h>
+
+#include "pico/stdlib.h"
+#include "pico/stdio/driver.h"
+
+#include "transport.h"
+#include "command.h"
+
+// Pull in the command state from command.c
+extern bool cmd_ready;
+
+// Pull in the transport table from transport.c
+extern transport_t* transports[];
+
+// In-memory transport for exercising the command engine without a host.
+// Commands are fed in with loopback_write() and the responses can be collected with
+// loopback_read(), as the loopback also registers itself as a stdio output while enabled.
+// LOOPBACK uses it to run a command through cmd_read_char and cmd_decode, like one arriving on USB or UART.
+
+#define LOOPBACK_BUF_LEN 1024
+
+char loopback_in[LOOPBACK_BUF_LEN];
+uint32_t loopback_in_wr = 0;
+uint32_t loopback_in_rd = 0;
+
+char loopback_out[LOOPBACK_BUF_LEN];
+uint32_t loopback_out_wr = 0;
+uint32_t loopback_out_rd = 0;
+
+// Responses that don't fit are dropped
+void loopback_out_chars(const char* buf, int len) {
+	for (int i = 0; i < len; i++) {
+		if ((loopback_out_wr + 1) % LOOPBACK_BUF_LEN == loopback_out_rd)
+			return;
+		loopback_out[loopback_out_wr] = buf[i];
+		loopback_out_wr = (loopback_out_wr + 1) % LOOPBACK_BUF_LEN;
+	}
+}
+
+stdio_driver_t stdio_loopback = {
+	.out_chars = loopback_out_chars,
+#if PICO_STDIO_ENABLE_CRLF_SUPPORT
+	.crlf_enabled = false,
+#endif
+};
+
+void loopback_enable(bool enabled) {
+	loopback_in_wr = loopback_in_rd = 0;
+	loopback_out_wr = loopback_out_rd = 0;
+	stdio_set_driver_enabled(&stdio_loopback, enabled);
+	transport_loopback.active = enabled;
+}
+
+// Queue characters for the command engine, returns the number of characters accepted
+uint32_t loopback_write(const char* buf, uint32_t len) {
+	uint32_t i;
+	for (i = 0; i < len; i++) {
+		if ((loopback_in_wr + 1) % LOOPBACK_BUF_LEN == loopback_in_rd)
+			break;
+		loopback_in[loopback_in_wr] = buf[i];
+		loopback_in_wr = (loopback_in_wr + 1) % LOOPBACK_BUF_LEN;
+	}
+	return i;
+}
+
+// Collect responses, returns the number of characters read
+uint32_t loopback_read(char* buf, uint32_t len) {
+	uint32_t i;
+	for (i = 0; i < len && loopback_out_rd != loopback_out_wr; i++) {
+		buf[i] = loopback_out[loopback_out_rd];
+		loopback_out_rd = (loopback_out_rd + 1) % LOOPBACK_BUF_LEN;
+	}
+	return i;
+}
+
+bool loopback_available() {
+	return loopback_in_rd != loopback_in_wr;
+}
+
+int loopback_read_char() {
+	if (loopback_in_rd == loopback_in_wr)
+		return PICO_ERROR_NO_DATA;
+
+	int c = (unsigned char)loopback_in[loopback_in_rd];
+	loopback_in_rd = (loopback_in_rd + 1) % LOOPBACK_BUF_LEN;
+	return c;
+}
+
+transport_t transport_loopback = {
+	.name = "LOOPBACK",
+	.init = NULL,
+	.available = loopback_available,
+	.read_char = loopback_read_char,
+	.active = false,
+};
+
+// LOOPBACK cmd
+// Feed cmd through the loopback and return its response on a single line
+void loopback_cmd(char* next_token) {
+	static char resp[LOOPBACK_BUF_LEN];
+	bool active[N_TRANSPORTS];
+
+	if (transport_loopback.active) {
+		printf("Error: LOOPBACK can't be nested!\n");
+		return;
+	}
+	if (!next_token || !*next_token) {
+		printf("Error: command parameter could not be parsed.\n");
+		return;
+	}
+
+	// The rest of the line is the command, it's copied before cmd_decode reuses the buffer
+	loopback_enable(true);
+	if (loopback_write(next_token, strlen(next_token)) != strlen(next_token) || loopback_write("\n", 1) != 1) {
+		loopback_enable(false);
+		printf("Error: command is too long for the loopback!\n");
+		return;
+	}
+
+	// Only the loopback is read and responses only go to it, until the command has been processed
+	for (uint i = 0; i < N_TRANSPORTS; i++) {
+		active[i] = transports[i]->active;
+		transports[i]->active = transports[i] == &transport_loopback;
+	}
+	stdio_filter_driver(&stdio_loopback);
+
+	while (!cmd_ready && loopback_available())
+		cmd_read_char();
+	if (cmd_ready) {
+		cmd_decode();
+		cmd_ready = false;
+	}
+
+	stdio_filter_driver(NULL);
+	for (uint i = 0; i < N_TRANSPORTS; i++)
+		transports[i]->active = active[i];
+
+	uint32_t len = loopback_read(resp, LOOPBACK_BUF_LEN - 1);
+	loopback_enable(false);
+
+	// Responses are a single line, but keep the reply to one line even if they aren't
+	while (len > 0 && (resp[len - 1] == '\n' || resp[len - 1] == '\r'))
+		len--;
+	resp[len] = '\0';
+	for (uint32_t i = 0; i < len; i++)
+		if (resp[i] == '\n' || resp[i] == '\r')
+			resp[i] = ' ';
+
+	printf("LOOPBACK %s\n", resp);
+}
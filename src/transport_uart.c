@@ -0,0 +1,57 @@
+// Copyright (c) 2026 Bence Göblyös
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include <stdio.h>
+
+#include "pico/stdlib.h"
+#include "hardware/uart.h"
+#include "hardware/dma.h"
+
+#include "transport.h"
+#include "hardware.h"
+
+// Incoming bytes are moved from the UART into a ring by DMA, so no characters are lost
+// at high baud rates even if the main loop is busy
+#define UART_RING_BITS 12
+#define UART_RING_LEN (1 << UART_RING_BITS)
+uint8_t uart_ring[UART_RING_LEN] __aligned(UART_RING_LEN);
+
+ring_dma_t uart_rx = {.dma = -1, .reload = -1};
+uint32_t uart_read_pos = 0;     // DMA position of the next character to be read
+
+// Transmit and the baud rate are set up by setup_default_uart() for stdio, only receive is taken over here.
+// The lower byte of the data register holds the character.
+void uart_transport_init() {
+	ring_dma_init(&uart_rx, uart_ring, UART_RING_BITS, DMA_SIZE_8, &uart_get_hw(uart_default)->dr, uart_get_dreq(uart_default, false));
+	uart_read_pos = 0;
+	ring_dma_start(&uart_rx);
+}
+
+bool uart_available() {
+	return ring_dma_pos(&uart_rx) != uart_read_pos;
+}
+
+int uart_read_char() {
+	uint32_t pos = ring_dma_pos(&uart_rx);
+	if (pos == uart_read_pos)
+		return PICO_ERROR_NO_DATA;
+
+	// If the DMA has lapped the reader, the oldest characters have been overwritten.
+	// Flush everything received so far, the command engine discards the partial line.
+	if (((pos - uart_read_pos) & (RING_DMA_LEN - 1)) > UART_RING_LEN) {
+		uart_read_pos = pos;
+		return PICO_ERROR_IO;
+	}
+
+	int c = uart_ring[uart_read_pos % UART_RING_LEN];
+	uart_read_pos = (uart_read_pos + 1) & (RING_DMA_LEN - 1);
+	return c;
+}
+
+transport_t transport_uart = {
+	.name = "UART",
+	.init = uart_transport_init,
+	.available = uart_available,
+	.read_char = uart_read_char,
+	.active = true,
+};
@@ -0,0 +1,30 @@
+import pyvisa
+import time
+
+rm = pyvisa.ResourceManager()
+
+# Define port for the pico-pulse
+port = "/dev/ttyACM0"
+
+# Connection over UART bridge, Baud rate must be set 115200
+# dev = rm.open_resource(f"ASRL{port}::INSTR", baud_rate=115200)
+
+# Collection over USB port
+dev = rm.open_resource(f"ASRL{port}::INSTR")
+
+def wrap_query(q):
+    print(f"Query: {repr(q)}")
+    resp = dev.query(q)
+    print(f"Response: {repr(resp)}")
+    return resp
+
+wrap_query("IDN?")     # Print serial number
+
+# Loop channel 1 (GPIO 7) back to ADC input 0 (GPIO 26) and use channel 0 as the window.
+# Window 0 sees channel 1 high, window 1 sees it low.
+wrap_query("BOXCAR 0 0")
+wrap_query("PULSE 1 1000 20000,3,20000,0,20000,1,20000,0")
+time.sleep(0.1)
+wrap_query("BOXCAR?")
+wrap_query("BOXDATA?")  # Expect a mean near 4095 for window 0 and near 0 for window 1
+wrap_query("BOXCAR OFF")
@@ -0,0 +1,30 @@
+import pyvisa
+import time
+
+rm = pyvisa.ResourceManager()
+
+# Define port for the pico-pulse
+port = "/dev/ttyACM0"
+
+# Connection over UART bridge, Baud rate must be set 115200
+# dev = rm.open_resource(f"ASRL{port}::INSTR", baud_rate=115200)
+
+# Collection over USB port
+dev = rm.open_resource(f"ASRL{port}::INSTR")
+
+def wrap_query(q):
+    print(f"Query: {repr(q)}")
+    resp = dev.query(q)
+    print(f"Response: {repr(resp)}")
+    return resp
+
+wrap_query("IDN?")     # Print serial number
+
+# Loop channel 1 (GPIO 7) back to GPIO 2 and gate with channel 0.
+# Gate 0 sees 2 pulses, gate 1 sees 1 pulse, per sequence.
+wrap_query("COUNTER 2 0")
+wrap_query("PULSE 1 1000 100,1,100,3,100,1,100,3,100,1,100,0,100,1,100,3,100,1,100,0")
+time.sleep(0.1)
+wrap_query("COUNTER?")
+wrap_query("COUNTS?")  # Expect 2000,1000
+wrap_query("COUNTER OFF")
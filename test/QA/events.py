@@ -0,0 +1,32 @@
+import pyvisa
+import time
+
+rm = pyvisa.ResourceManager()
+
+# Define port for the pico-pulse
+port = "/dev/ttyACM0"
+
+# Connection over UART bridge, Baud rate must be set 115200
+# dev = rm.open_resource(f"ASRL{port}::INSTR", baud_rate=115200)
+
+# Collection over USB port
+dev = rm.open_resource(f"ASRL{port}::INSTR")
+
+def wrap_query(q):
+    print(f"Query: {repr(q)}")
+    resp = dev.query(q)
+    print(f"Response: {repr(resp)}")
+    return resp
+
+
+# Run a 1 ms sequence 1000 times and wait for the events instead of polling BUSY?
+wrap_query("EVENTS 1 250")
+wrap_query("PULSE 1 1000 500000,1,500000,0")
+# Exactly 4 events: PASS at 250, 500, 750, then DONE at 1000. The last field is the cycle counter.
+expected = ["EVENT:PASS 0,250,", "EVENT:PASS 0,500,", "EVENT:PASS 0,750,", "EVENT:DONE 0,1000,"]
+for prefix in expected:
+    line = dev.read()
+    print(repr(line))
+    assert line.startswith(prefix), f"expected {prefix!r}"
+    assert line[len(prefix):].strip().isdigit()
+wrap_query("EVENTS 0")
@@ -0,0 +1,31 @@
+import pyvisa
+import time
+
+rm = pyvisa.ResourceManager()
+
+# Define port for the pico-pulse
+port = "/dev/ttyACM0"
+
+# Connection over UART bridge, Baud rate must be set 115200
+# dev = rm.open_resource(f"ASRL{port}::INSTR", baud_rate=115200)
+
+# Collection over USB port
+dev = rm.open_resource(f"ASRL{port}::INSTR")
+
+def wrap_query(q):
+    print(f"Query: {repr(q)}")
+    resp = dev.query(q)
+    print(f"Response: {repr(resp)}")
+    return resp
+
+
+# Store a sequence three times the size of the RAM buffer in flash and play it.
+# Channel 0 toggles every 100 ns, 200000 words in total.
+wrap_query("FLASH:BEGIN")
+for i in range(100):
+    wrap_query("FLASH:APPEND " + ",".join(["100,1,100,0"] * 1000))
+wrap_query("FLASH:END")
+wrap_query("FLASH?")   # min_avg_ns should be well below 100
+wrap_query("FLASH:RUN 10")
+time.sleep(0.5)
+wrap_query("BUSY?")    # Expect 0
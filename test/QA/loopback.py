@@ -0,0 +1,37 @@
+import pyvisa
+import time
+
+rm = pyvisa.ResourceManager()
+
+# Define port for the pico-pulse
+port = "/dev/ttyACM0"
+
+# Connection over UART bridge, Baud rate must be set 115200
+# dev = rm.open_resource(f"ASRL{port}::INSTR", baud_rate=115200)
+
+# Collection over USB port
+dev = rm.open_resource(f"ASRL{port}::INSTR")
+
+def wrap_query(q):
+    print(f"Query: {repr(q)}")
+    resp = dev.query(q)
+    print(f"Response: {repr(resp)}")
+    return resp
+
+
+# Commands fed through the loopback transport go through the same reader and decoder,
+# so they must give the same responses as the ones sent directly
+for q in ["*IDN?", "OPTIMIZE?", "GROUP?"]:
+    direct = wrap_query(q).strip()
+    looped = wrap_query("LOOPBACK " + q).strip()
+    assert looped == "LOOPBACK " + direct, f"{looped!r} != {direct!r}"
+
+# Commands change the state of the device the same way
+wrap_query("PULSE 0 0 100,1,100,0")
+assert wrap_query("LOOPBACK BUSY?").startswith("LOOPBACK ")
+assert wrap_query("LOOPBACK STOP").strip() == "LOOPBACK ACK"
+
+# Errors are returned through the loopback as well
+assert wrap_query("LOOPBACK PULSE").strip() == "LOOPBACK Error: m parameter could not be parsed."
+assert wrap_query("LOOPBACK LOOPBACK *IDN?").strip() == "LOOPBACK Error: LOOPBACK can't be nested!"
+assert wrap_query("LOOPBACK").strip() == "Error: command parameter could not be parsed."
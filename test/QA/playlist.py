@@ -0,0 +1,27 @@
+import pyvisa
+import time
+
+rm = pyvisa.ResourceManager()
+
+# Define port for the pico-pulse
+port = "/dev/ttyACM0"
+
+# Connection over UART bridge, Baud rate must be set 115200
+# dev = rm.open_resource(f"ASRL{port}::INSTR", baud_rate=115200)
+
+# Collection over USB port
+dev = rm.open_resource(f"ASRL{port}::INSTR")
+
+def wrap_query(q):
+    print(f"Query: {repr(q)}")
+    resp = dev.query(q)
+    print(f"Response: {repr(resp)}")
+    return resp
+
+
+# Init pulse, 100x a 1 us pulse on channel 1, readout on channel 2, 50x a 2 us pulse on channel 3
+wrap_query("PULSE 1 0 5000,1,1000,2,1000,0,3000,4,2000,8,2000,0")
+wrap_query("PLAYLIST 3 0:1:1 1:3:100 3:4:1 4:6:50")
+time.sleep(0.01)
+wrap_query("PLAYLIST?")  # Expect 0,4,0,3
+wrap_query("PLAYLIST OFF")
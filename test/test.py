@@ -6,7 +6,7 @@ rm = pyvisa.ResourceManager()
 # Define port for the pico-pulse
 port = "/dev/ttyACM0"
 
-# Connection over UART bridge, Baud rate must be set 115200
+# Connection over UART, Baud rate must match PICO_PULSE_UART_BAUD (115200 by default)
 # dev = rm.open_resource(f"ASRL{port}::INSTR", baud_rate=115200)
 
 # Collection over USB port